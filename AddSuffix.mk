@@ -14,9 +14,12 @@ OUTPUT_FILES= $(OUT_LIB)
 # NOTE: the program considers #ifdefs and does not replace things inside false #defs
 # since these elements will not be part of the parsed AST
 # 
-# NOTE: #macros are expanded before the AST processing, this means that we can't
-# replace references inside macros in the original source unless we expand
-# all macros before performing any replacements
+# NOTE: references inside of #macros are replaced where they are spelled, if
+# the same token in a #define body expands to a name that should not be
+# renamed in another context, the token is left as is and a warning is emitted.
+# Only the main file is written with OUTPUT_MODE=stdout, run.sh then expands
+# the macros with pcpp first (EXPAND=true) so that references in the macros
+# of headers end up in the output
 
 # clang -Xclang -ast-dump ~/Repos/oniguruma/src/st.c -Isrc -I/usr/include -E
 #TARGET_DIR=~/Repos/oniguruma
@@ -32,7 +35,7 @@ INCLUDE_DIR=$(TARGET_DIR)/
 REPLACE_FILE=/home/jonas/Repos/euf/tests/data/onig_rename.txt
 INPUT_FILE=$(TARGET_DIR)/st.c
 GREP_TARGET=rehash
-EXPAND=true
+OUTPUT_MODE=stdout
 
 .PHONY: clean run
 
@@ -50,7 +53,7 @@ run: $(OUTPUT_FILES)
 	INCLUDE_DIR=$(INCLUDE_DIR) \
 	TARGET_DIR=$(TARGET_DIR) \
 	REPLACE_FILE=$(REPLACE_FILE) \
-	EXPAND=$(EXPAND) \
+	OUTPUT_MODE=$(OUTPUT_MODE) \
 	time ./run.sh $(INPUT_FILE) > /tmp/out.c
 
 example: run
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+'''
+Generates a synthetic C corpus for benchmarking the plugins
+
+  <out>/include/h_0.h ... h_<depth-1>.h   Chain of headers, each one includes
+                                          the next, the last one declares
+                                          every function
+  <out>/src/tu_<n>.c                      Translation units with call sites
+  <out>/names.txt                         The names to analyze/rename
+  <out>/compile_commands.json
+
+Every call site passes a mix of literals (INT, CHR, STR and sizeof()),
+macros that expand to literals and references to variables. Names beyond
+the number of functions do not occur in the corpus.
+
+USAGE:
+  ./bench/gen_corpus.py /tmp/corpus --functions 200 --calls 5000 '\'
+    --names 50 --header-depth 4 --arg-mix literal=5,macro=3,ref=2
+'''
+import argparse
+import json
+import random
+from pathlib import Path
+
+ARG_KINDS = ("literal", "macro", "ref")
+
+def parse_mix(value: str) -> dict[str, float]:
+    mix = {kind: 0.0 for kind in ARG_KINDS}
+    for item in value.split(","):
+        kind, _, weight = item.partition("=")
+        if kind not in mix:
+            raise argparse.ArgumentTypeError(f"unknown argument kind: {kind}")
+        mix[kind] = float(weight)
+    if sum(mix.values()) <= 0:
+        raise argparse.ArgumentTypeError("the weights must not all be zero")
+    return mix
+
+def fn_name(i: int) -> str:
+    return f"bench_fn_{i}"
+
+def param_type(i: int) -> str:
+    # Every third parameter is a string
+    return "const char *" if i % 3 == 2 else "int "
+
+def int_literal(rng: random.Random) -> str:
+    return rng.choice((
+        str(rng.randrange(16)),
+        f"'{rng.choice('abcxyz')}'",
+        f"sizeof(struct bench_s{rng.randrange(4)})",
+    ))
+
+def str_literal(rng: random.Random) -> str:
+    return f'"s{rng.randrange(16)}"'
+
+def gen_headers(root: Path, args, rng: random.Random):
+    include = root / "include"
+    include.mkdir(parents=True, exist_ok=True)
+
+    for d in range(args.header_depth):
+        lines = [f"#ifndef BENCH_H_{d}", f"#define BENCH_H_{d}", ""]
+        if d + 1 < args.header_depth:
+            lines.append(f'#include "h_{d+1}.h"')
+        else:
+            lines += [f"struct bench_s{k} {{ char c[{k+1}]; }};"
+                      for k in range(4)]
+            for i in range(args.functions):
+                params = ", ".join(f"{param_type(p)}p{p}"
+                                   for p in range(args.params))
+                lines.append(f"int {fn_name(i)}({params});")
+        lines.append("")
+
+        # Macros are spread over every header
+        for m in range(args.macros):
+            if m % args.header_depth == d:
+                lines.append(f"#define BENCH_INT_{m} {int_literal(rng)}")
+                lines.append(f"#define BENCH_STR_{m} {str_literal(rng)}")
+
+        # Call sites inside of (static inline) header functions, only the
+        # macros of this header and of the headers it includes are visible
+        if args.header_calls > 0:
+            macros = [m for m in range(args.macros) if m % args.header_depth >= d]
+            lines += ["", f"static inline int bench_inline_{d}(int v) {{",
+                      "  int r = 0;"]
+            for _ in range(args.header_calls):
+                call = gen_call(rng, args, macros, ["v"], ["0"])
+                lines.append(f"  r += {call};")
+            lines += ["  return r;", "}"]
+
+        lines += ["", "#endif", ""]
+        (include / f"h_{d}.h").write_text("\n".join(lines))
+
+def gen_arg(rng: random.Random, args, index: int, macros: list[int],
+            int_refs: list[str], str_refs: list[str]) -> str:
+    kind = rng.choices(ARG_KINDS, weights=[args.arg_mix[k] for k in ARG_KINDS])[0]
+    is_str = param_type(index) != "int "
+
+    if kind == "macro" and len(macros) > 0:
+        return f"BENCH_{'STR' if is_str else 'INT'}_{rng.choice(macros)}"
+    if kind == "ref":
+        return rng.choice(str_refs if is_str else int_refs)
+    return str_literal(rng) if is_str else int_literal(rng)
+
+def gen_call(rng: random.Random, args, macros: list[int],
+             int_refs: list[str], str_refs: list[str]) -> str:
+    call_args = ", ".join(gen_arg(rng, args, p, macros, int_refs, str_refs)
+                          for p in range(args.params))
+    return f"{fn_name(rng.randrange(args.functions))}({call_args})"
+
+def gen_tu(path: Path, args, calls: int, rng: random.Random):
+    lines = ['#include "h_0.h"', "",
+             "int bench_global = 1;",
+             'const char *bench_global_str = "g";', ""]
+
+    # The call sites are split over functions of (at most) 50 calls each
+    for f in range(0, calls, 50):
+        lines += [f"int bench_caller_{f}(int a, const char *s) {{",
+                  "  int r = 0;",
+                  "  int local = a + 1;",
+                  '  const char *local_str = s;']
+        for c in range(f, min(f + 50, calls)):
+            call = gen_call(rng, args, list(range(args.macros)),
+                            ["a", "local", "bench_global"],
+                            ["s", "local_str", "bench_global_str"])
+            # A call that is a statement of its own is skipped by ArgStates,
+            # the return value is used for most of them
+            lines.append(f"  {call};" if c % 10 == 0 else f"  r += {call};")
+        lines += ["  return r;", "}", ""]
+
+    path.write_text("\n".join(lines))
+
+def generate(root: Path, args):
+    rng = random.Random(args.seed)
+    root.mkdir(parents=True, exist_ok=True)
+    (root / "src").mkdir(exist_ok=True)
+
+    gen_headers(root, args, rng)
+
+    commands = []
+    per_tu = [args.calls // args.tus + (1 if t < args.calls % args.tus else 0)
+              for t in range(args.tus)]
+    for t, calls in enumerate(per_tu):
+        path = root / "src" / f"tu_{t}.c"
+        gen_tu(path, args, calls, rng)
+        commands.append({
+            "directory": str(root.absolute()),
+            "file": str(path.absolute()),
+            "arguments": ["clang", "-c", "-Iinclude", str(path.absolute())],
+        })
+
+    names = [fn_name(i) for i in range(min(args.names, args.functions))]
+    names += [f"bench_missing_{i}" for i in range(args.names - len(names))]
+    (root / "names.txt").write_text("\n".join(names) + "\n")
+
+    (root / "compile_commands.json").write_text(json.dumps(commands,
+                                                           indent=2))
+
+def add_arguments(parser: argparse.ArgumentParser):
+    parser.add_argument("--tus", type=int, default=4,
+        help="Number of translation units (default: 4)")
+    parser.add_argument("--functions", type=int, default=200,
+        help="Number of declared functions (default: 200)")
+    parser.add_argument("--params", type=int, default=3,
+        help="Number of parameters of every function (default: 3)")
+    parser.add_argument("--calls", type=int, default=5000,
+        help="Number of call sites over all TUs (default: 5000)")
+    parser.add_argument("--header-calls", type=int, default=10,
+        help="Number of call sites in every header (default: 10)")
+    parser.add_argument("--macros", type=int, default=32,
+        help="Number of literal macros (default: 32)")
+    parser.add_argument("--arg-mix", type=parse_mix,
+        default=parse_mix("literal=5,macro=3,ref=2"),
+        help="Weights of each argument kind (default: literal=5,macro=3,ref=2)")
+    parser.add_argument("--header-depth", type=int, default=4,
+        help="Length of the chain of included headers (default: 4)")
+    parser.add_argument("--names", type=int, default=50,
+        help="Number of names to analyze/rename (default: 50)")
+    parser.add_argument("--seed", type=int, default=0,
+        help="Seed for the generator, the corpus is deterministic")
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description="Generate a synthetic C corpus")
+    parser.add_argument("out", type=Path, help="Output directory")
+    add_arguments(parser)
+    args = parser.parse_args()
+
+    if args.tus < 1 or args.header_depth < 1 or args.functions < 1:
+        parser.error("--tus, --header-depth and --functions must be >= 1")
+    generate(args.out, args)
@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+'''
+Benchmarks the ArgStates and AddSuffix plugins over synthetic corpora
+
+For every point of a sweep a corpus is generated with gen_corpus.py, each
+plugin is then run over every TU of the corpus. The wall time (summed over
+the TUs, best of --repeat runs), the peak RSS (of the largest TU) and the
+counters from the PLUGIN_STATS summary of each plugin are reported.
+
+The corpus options of gen_corpus.py set the fixed parameters, a sweep
+overrides one of them, e.g.
+
+  ./bench/run_bench.py --sweep names=1,16,256 --sweep calls=1000,10000 '\'
+    --functions 500 --csv bench.csv
+
+The ArgStates timings include the second pass, REF counts the arguments
+that reference a variable and are resolved by it.
+'''
+import argparse
+import csv
+import os
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).parent))
+from gen_corpus import add_arguments, generate
+
+REPO_DIR = Path(__file__).parent.parent.absolute()
+DEFAULT_SWEEPS = ["names=1,16,256", "calls=1000,10000,50000"]
+
+def parse_sweep(value: str) -> tuple[str, list[int]]:
+    name, _, points = value.partition("=")
+    try:
+        return name.replace("-", "_"), [int(p) for p in points.split(",")]
+    except ValueError:
+        raise argparse.ArgumentTypeError(f"invalid sweep: {value}")
+
+def parse_stats(stderr: str, counters: dict[str, int]):
+    '''
+    Sum the counters of every 'stats>' summary line, the timers are skipped
+    '''
+    for line in stderr.splitlines():
+        if not line.startswith("stats> "):
+            continue
+        for item in line.split(": ", 1)[-1].split():
+            key, _, value = item.partition("=")
+            if value.isdigit():
+                counters[key] = counters.get(key, 0) + int(value)
+
+def run_plugin(args, plugin: str, plugin_args: list[str], tu: Path,
+               corpus: Path, env: dict[str, str]) -> tuple[float, int, str]:
+    '''
+    Returns the wall time, the peak RSS (in KiB) and the stderr of one run
+    '''
+    cmd = [args.clang, "-fsyntax-only",
+           "-Xclang", "-load", "-Xclang",
+           str(args.build_dir / "lib" / f"lib{plugin}.so"),
+           "-Xclang", "-plugin", "-Xclang", plugin]
+    for arg in plugin_args:
+        cmd += ["-Xclang", f"-plugin-arg-{plugin}", "-Xclang", arg]
+    cmd += ["-I", str(corpus / "include"), str(tu)]
+
+    start = time.perf_counter()
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, text=True, env=env)
+    stderr = proc.stderr.read()
+    # wait4() provides the resource usage of this child only
+    _, status, rusage = os.wait4(proc.pid, 0)
+    elapsed = time.perf_counter() - start
+    proc.returncode = os.waitstatus_to_exitcode(status)
+
+    if proc.returncode != 0:
+        sys.exit(f"{plugin} failed on {tu}:\n{stderr}")
+    return elapsed, rusage.ru_maxrss, stderr
+
+def bench_corpus(args, corpus: Path) -> list[dict]:
+    names = corpus / "names.txt"
+    tus = sorted((corpus / "src").glob("*.c"))
+    env = dict(os.environ, PLUGIN_STATS="1")
+    env.pop("DEBUG_AST", None)
+
+    plugins = {
+        "ArgStates": ["-names-file", str(names)],
+        "AddSuffix": ["-names-file", str(names), "-suffix", "_bench",
+                      "-output-mode", "replacements"],
+    }
+    rows = []
+
+    for plugin, plugin_args in plugins.items():
+        best = float("inf")
+        peak_rss = 0
+        counters: dict[str, int] = {}
+
+        for i in range(args.repeat):
+            # The states are appended to one log rather than written
+            # as one file per symbol and TU
+            env["ARG_STATES_OUT_LOG"] = str(corpus / f"states.{i}.log")
+            total = 0.0
+            stats = ""
+            for tu in tus:
+                elapsed, rss, stderr = run_plugin(args, plugin, plugin_args,
+                                                  tu, corpus, env)
+                total += elapsed
+                peak_rss = max(peak_rss, rss)
+                stats += stderr
+            best = min(best, total)
+            if i == 0:
+                parse_stats(stats, counters)
+
+        rows.append({
+            "plugin": plugin,
+            "time_s": f"{best:.3f}",
+            "peak_rss_mb": f"{peak_rss / 1024:.1f}",
+            "counters": " ".join(f"{k}={v}" for k, v in counters.items()),
+        })
+    return rows
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description="Benchmark the plugins over synthetic corpora")
+    parser.add_argument("--sweep", type=parse_sweep, action="append",
+        help="<corpus option>=<value>,... to vary, can be given several times"
+             f" (default: {' '.join(DEFAULT_SWEEPS)})")
+    parser.add_argument("--build-dir", type=Path, default=REPO_DIR / "build",
+        help="Build directory with lib/libArgStates.so and lib/libAddSuffix.so")
+    parser.add_argument("--clang", default="clang",
+        help="The clang that the plugins were built against")
+    parser.add_argument("--repeat", type=int, default=3,
+        help="Number of runs of every plugin, the fastest is reported")
+    parser.add_argument("--csv", type=Path,
+        help="Also write the results to this file")
+    add_arguments(parser)
+    args = parser.parse_args()
+
+    sweeps = args.sweep or [parse_sweep(s) for s in DEFAULT_SWEEPS]
+    for name, _ in sweeps:
+        if not hasattr(args, name):
+            parser.error(f"unknown corpus option in --sweep: {name}")
+
+    results = []
+    print(f"{'sweep':<16} {'plugin':<10} {'time (s)':>9} {'RSS (MB)':>9}"
+          "  counters")
+
+    for name, points in sweeps:
+        for point in points:
+            corpus_args = argparse.Namespace(**vars(args))
+            setattr(corpus_args, name, point)
+
+            with tempfile.TemporaryDirectory(prefix="bench-") as tmp:
+                generate(Path(tmp), corpus_args)
+                for row in bench_corpus(args, Path(tmp)):
+                    row = {"sweep": name, "value": point, **row}
+                    results.append(row)
+                    print(f"{name + '=' + str(point):<16} {row['plugin']:<10} "
+                          f"{row['time_s']:>9} {row['peak_rss_mb']:>9}  "
+                          f"{row['counters']}", flush=True)
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(results[0].keys()))
+            writer.writeheader()
+            writer.writerows(results)
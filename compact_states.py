@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+'''
+Folds the log written by ArgStates (with ARG_STATES_OUT_LOG set) into one
+file per symbol, on the same form as the per-TU output of the plugin
+
+  {
+    "<symbol>": {
+      "<param>": [ <states>... ]
+    }
+  }
+
+A param is nondet() (an empty list) if it is nondet() in any TU, otherwise
+its states are the union of the states from every TU. If the same TU has
+several records for a symbol (e.g. the log was not cleared between runs)
+only the last one is used.
+
+USAGE:
+  ./compact_states.py states.log .states
+'''
+import argparse
+import json
+import sys
+from pathlib import Path
+
+RECORD_START = '{"symbol":'
+
+def parse_line(line: str, lineno: int) -> dict|None:
+    try:
+        return json.loads(line)
+    except json.JSONDecodeError:
+        pass
+
+    # A short write leaves a truncated record that the next record
+    # is appended to, the trailing record is still usable
+    start = line.rfind(RECORD_START)
+    if start > 0:
+        try:
+            return json.loads(line[start:])
+        except json.JSONDecodeError:
+            pass
+
+    print(f"Skipping malformed record on line {lineno}", file=sys.stderr)
+    return None
+
+def read_log(path: Path) -> dict[str, dict[str, list]]:
+    '''
+    Returns the params of the last record for every symbol and TU
+    '''
+    records: dict[str, dict[str, list]] = {}
+
+    with open(path, encoding='utf8', errors='replace') as f:
+        for lineno, line in enumerate(f, start=1):
+            line = line.strip()
+            if line == "":
+                continue
+            record = parse_line(line, lineno)
+            if record is None:
+                continue
+            records.setdefault(record['symbol'], {})[record['tu']] = \
+                record['params']
+
+    return records
+
+def fold(tus: dict[str, list]) -> dict[str, list]:
+    '''
+    Join the params of one symbol from every TU, the params are
+    merged by position since the names are derived from calls
+    '''
+    names: list[str] = []
+    nondet: list[bool] = []
+    states: list[set] = []
+
+    for tu in sorted(tus):
+        for i, param in enumerate(tus[tu]):
+            if i == len(names):
+                names.append(param['name'])
+                nondet.append(False)
+                states.append(set())
+            nondet[i] |= param['nondet']
+            states[i].update(param['states'])
+
+    return {
+        name: [] if nondet[i] else \
+              sorted(states[i], key=lambda s: (isinstance(s, str), s))
+        for i, name in enumerate(names)
+    }
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description="Fold an ArgStates log into one file per symbol")
+    parser.add_argument('log', type=Path,
+        help="The log written to ARG_STATES_OUT_LOG")
+    parser.add_argument('output_dir', type=Path,
+        help="Directory to write <symbol>.json files to")
+    args = parser.parse_args()
+
+    args.output_dir.mkdir(parents=True, exist_ok=True)
+
+    for symbol, tus in read_log(args.log).items():
+        with open(args.output_dir / f"{symbol}.json", 'w',
+                  encoding='utf8') as f:
+            json.dump({symbol: fold(tus)}, f, indent=2, ensure_ascii=False)
+            f.write("\n")
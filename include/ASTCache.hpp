@@ -0,0 +1,58 @@
+#ifndef ASTCache_H
+#define ASTCache_H
+
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Serialization/PCHContainerOperations.h"
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include <memory>
+#include <string>
+
+//-----------------------------------------------------------------------------
+// On-disk cache of serialized ASTs
+// Every TU is parsed once and saved as an AST file in the cache directory,
+// later runs load the AST file instead of parsing the TU again.
+//
+// Entries are keyed by the content of the main file, the command line
+// (including the working directory) and the version of clang. The headers
+// of a TU are not part of the key, the AST reader validates them on load and
+// a stale entry is rebuilt when one of them has been modified.
+//
+// Every load or store updates the modification time of an entry, once the
+// cache grows beyond its size limit the least recently used entries are
+// removed.
+//
+// ASTs that were loaded from the cache reference the PCH reader of the cache,
+// the cache must therefore outlive every ASTUnit that it returns.
+//-----------------------------------------------------------------------------
+class ASTCache {
+public:
+  ASTCache(std::string directory, uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes) {}
+
+  /// Returns the AST for the given file, loaded from the cache if
+  /// possible and parsed (and added to the cache) otherwise. A nullptr
+  /// is returned if the file has no compile command or could not be parsed.
+  std::unique_ptr<clang::ASTUnit> get(
+    const clang::tooling::CompilationDatabase &db, llvm::StringRef file);
+
+  /// Remove the least recently used entries until the total size of the
+  /// cache is below the size limit
+  void evict();
+
+  unsigned hits = 0;
+  unsigned misses = 0;
+
+private:
+  std::string entryPath(const clang::tooling::CompileCommand &command);
+  std::unique_ptr<clang::ASTUnit> load(const std::string &path,
+    const clang::tooling::CompileCommand &command);
+  std::unique_ptr<clang::ASTUnit> build(
+    const clang::tooling::CompilationDatabase &db, llvm::StringRef file);
+
+  std::string directory;
+  uint64_t maxBytes;
+  clang::PCHContainerOperations pchOperations;
+};
+
+#endif
@@ -1,64 +1,81 @@
 #ifndef CLANG_TUTOR_AddSuffix_H
 #define CLANG_TUTOR_AddSuffix_H
 
-#include <unordered_set>
 #include "clang/AST/ASTConsumer.h"
+#include "clang/ASTMatchers/ASTMatchers.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/Frontend/FrontendAction.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Rewrite/Frontend/FixItRewriter.h"
 #include "clang/Tooling/CommonOptionsParser.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/IntervalMap.h"
+#include "llvm/ADT/MapVector.h"
 
-#define DEBUG_AST false
-
-#define hasNames10(arr,end) hasName(arr[end]), hasName(arr[end-1]), \
-  hasName(arr[end-2]), hasName(arr[end-3]), hasName(arr[end-4]), \
-  hasName(arr[end-5]), hasName(arr[end-6]), hasName(arr[end-7]), \
-  hasName(arr[end-8]), hasName(arr[end-9]) 
-
-#define hasNames100(arr,end) hasNames10(arr,end), \
-  hasNames10(arr,end - 10*1), hasNames10(arr,end - 10*2), \
-  hasNames10(arr,end - 10*3), hasNames10(arr,end - 10*4), \
-  hasNames10(arr,end - 10*5), hasNames10(arr,end - 10*6), \
-  hasNames10(arr,end - 10*7), hasNames10(arr,end - 10*8), \
-  hasNames10(arr,end - 10*9) 
-
-#define hasNames200(arr,end) hasNames100(arr,end), \
-  hasNames100(arr,end - 100*1)
-
-// We cannot define this as a regular class method since the prototype for the 
-// 'hasNames' function depends on how many elements lie within the object
-//
-// Match any: 
-//  - Function declerations
-//  - Function references (this includes function calls())
-//  - Variable declerations
-//  - Variable references
-//  that have 'anyOf' the provided (global) names
-//
-// Adding several matchers with the same .bind() string does 
-// not cause problems
-#define addMatchers(hasNames) do { \
-    const auto matcherForFunctionDecl = functionDecl(hasNames) \
-					  .bind("FunctionDecl"); \
- \
-    const auto matcherForVarDecl = varDecl(hasNames) \
-					  .bind("VarDecl"); \
- \
-    const auto matcherForRefExpr = declRefExpr(to(declaratorDecl( \
-					  hasNames))) \
-					  .bind("DeclRefExpr"); \
- \
- \
-    Finder.addMatcher(matcherForFunctionDecl, &(this->AddSuffixHandler)); \
-    Finder.addMatcher(matcherForVarDecl,      &(this->AddSuffixHandler)); \
-    Finder.addMatcher(matcherForRefExpr,      &(this->AddSuffixHandler)); \
- \
-} while (0)
+#include "NamesFile.hpp"
+#include "Stats.hpp"
 
+#define DEBUG_AST false
 
 using namespace clang;
 using namespace ast_matchers;
 
+// The identifiers (as interned by the lexer of the current TU) that
+// should be given a suffix
+typedef llvm::DenseSet<const IdentifierInfo*> IdentifierSet;
+
+namespace clang {
+namespace ast_matchers {
+  // Match any named declaration whose identifier is part of the given set.
+  // Unlike anyOf(hasName(...), ...) this is a single pointer lookup
+  // regardless of how many names we are searching for
+  AST_MATCHER_P(NamedDecl, hasIdentifierIn, const IdentifierSet*, Identifiers) {
+    const IdentifierInfo* identifier = Node.getIdentifier();
+    return identifier != nullptr && Identifiers->count(identifier) > 0;
+  }
+}
+}
+
+//-----------------------------------------------------------------------------
+// Options
+//-----------------------------------------------------------------------------
+enum OutputMode {
+  // Write the rewritten main file to stdout, edits in headers are dropped
+  OUTPUT_STDOUT,
+  // Write the edits made to every file as a replacements YAML document
+  // to stdout (the format read by clang-apply-replacements)
+  OUTPUT_REPLACEMENTS,
+  // Overwrite every modified file, each file is written to a temporary
+  // file first which is then moved into place
+  OUTPUT_IN_PLACE
+};
+
+struct AddSuffixOptions {
+  std::string Suffix;
+  OutputMode Mode = OUTPUT_STDOUT;
+
+  // Only match inside of top-level declarations from the main file
+  // and from headers that start with one of the AllowedHeaders prefixes.
+  // Without any AllowedHeaders, only the main file is ever modified, matches
+  // inside of macros that are defined in a header are reported instead
+  bool MainFileOnly = false;
+  std::vector<std::string> AllowedHeaders;
+
+  // With more than one thread, the top-level declarations are searched for
+  // the names in parallel and only the ones that contain a name are
+  // matched (see Shards.hpp)
+  unsigned Threads = 1;
+};
+
+// Indexes of the counters and timers in the Stats of each TU
+enum AddSuffixCounter {
+  COUNT_FUNCTION_DECL, COUNT_VAR_DECL, COUNT_DECL_REF_EXPR,
+  COUNT_KEPT_DECL, COUNT_KEPT_REF, COUNT_KEPT_MEMBER
+};
+enum AddSuffixTimer {
+  TIME_MATCH, TIME_RUN, TIME_WRITE
+};
+
 //-----------------------------------------------------------------------------
 // ASTFinder callback
 //-----------------------------------------------------------------------------
@@ -66,8 +83,12 @@ class AddSuffixMatcher
     : public MatchFinder::MatchCallback {
 public:
   explicit AddSuffixMatcher(Rewriter &RewriterForAddSuffix, 
-      std::string Suffix)
-      : AddSuffixRewriter(RewriterForAddSuffix), Suffix(Suffix)  {}
+      const AddSuffixOptions &Options, raw_ostream &Out, Stats &Statistics)
+      : RenamedRanges(RenamedAllocator),
+        AddSuffixRewriter(RewriterForAddSuffix), Suffix(Options.Suffix),
+        Mode(Options.Mode), Out(Out), Statistics(Statistics),
+        MainFileEdits(Options.MainFileOnly &&
+                      Options.AllowedHeaders.empty()) {}
 
   void onEndOfTranslationUnit() override;
 
@@ -76,24 +97,59 @@ public:
 private:
   void replaceInDeclRefMatch(
     const MatchFinder::MatchResult &result, 
-    std::string bindName);
+    StringRef bindName, AddSuffixCounter counter);
   void replaceInDeclMatch(
     const MatchFinder::MatchResult &result, 
-    std::string bindName);
+    StringRef bindName, AddSuffixCounter counter);
   void replaceInMatch(
-    const MatchFinder::MatchResult &result, std::string bindName,
-    SourceRange srcRange, std::string nodeName);
+    const MatchFinder::MatchResult &result, StringRef bindName,
+    SourceLocation location, StringRef nodeName);
+  bool replaceAt(SourceLocation location, StringRef nodeName);
+  void addMacroEdit(SourceLocation location, StringRef nodeName);
+  void addMacroKeep(SourceLocation location);
+  void applyMacroEdits();
+  void reportMacroConflict(SourceLocation location, StringRef nodeName,
+    StringRef reason);
+  void writeReplacements(raw_ostream &out);
 
   // To avoid renaming the same token several times
-  // we maintain a set of all locations which have been modified
-  std::unordered_set<std::string> renamedLocations = 
-	  std::unordered_set<std::string>({});
+  // we maintain the (closed) ranges of all locations which have been
+  // modified. The ranges are keyed on the raw encoding of each location,
+  // i.e. the offset of its FileID in the SourceManager plus the offset
+  // inside of the file
+  typedef llvm::IntervalMap<unsigned, bool> RangeMap;
+  RangeMap::Allocator RenamedAllocator;
+  RangeMap RenamedRanges;
+
+  // Matches inside of macro expansions, keyed on the raw encoding of the
+  // location where the token was spelled
+  struct MacroEdit {
+    SourceLocation Spelling;
+    StringRef Name;
+  };
+  llvm::MapVector<unsigned, MacroEdit> MacroEdits;
+  // Spellings that also expanded into a name that is not renamed
+  llvm::DenseSet<unsigned> KeptSpellings;
 
   Rewriter AddSuffixRewriter;
   // NOTE: This matcher already knows *what* name to search for 
   // because it _matched_ an expression that corresponds to
   // the command line arguments.
   std::string Suffix;
+  OutputMode Mode;
+  raw_ostream &Out;
+  Stats &Statistics;
+  // Macro spellings outside of the main file are not rewritten
+  bool MainFileEdits;
+
+  // Every replacement that has been made, in any file
+  struct Edit {
+    FileID File;
+    unsigned Offset;
+    unsigned Length;
+    std::string Text;
+  };
+  std::vector<Edit> Edits;
 };
 
 //-----------------------------------------------------------------------------
@@ -102,18 +158,52 @@ private:
 class AddSuffixASTConsumer : public ASTConsumer {
 public:
   AddSuffixASTConsumer(Rewriter &R, 
-      std::vector<std::string> Names, std::string Suffix
+      std::shared_ptr<const NamesFile> Names, const AddSuffixOptions &Options,
+      raw_ostream &Out = llvm::outs()
   );
 
-  void HandleTranslationUnit(ASTContext &Ctx) override {
-    Finder.matchAST(Ctx);
-  }
+  void HandleTranslationUnit(ASTContext &Ctx) override;
 
 private:
+  void setTraversalScope(ASTContext &Ctx);
+  bool isInScope(const SourceManager &Mgr, FileID File);
+
+  // Declared before the handler which holds a reference to it
+  Stats Statistics;
   MatchFinder Finder;
   AddSuffixMatcher AddSuffixHandler;
-  std::vector<std::string> Names;
-  std::string Suffix;
+  // Shared between every consumer created from the same names file
+  std::shared_ptr<const NamesFile> Names;
+  bool MainFileOnly;
+  std::vector<std::string> AllowedHeaders;
+  unsigned Threads;
+  FileID LastScopeFile;
+  bool LastScopeResult = false;
+
+  // Resolved from the Names once per TU, the matchers hold a
+  // pointer to this set
+  IdentifierSet Identifiers;
+};
+
+//-----------------------------------------------------------------------------
+// FrontendAction
+// Used when running AddSuffix through LibTooling rather than as a plugin,
+// the output of each TU is written to the given stream
+//-----------------------------------------------------------------------------
+class AddSuffixFrontendAction : public ASTFrontendAction {
+public:
+  AddSuffixFrontendAction(std::shared_ptr<const NamesFile> Names,
+      const AddSuffixOptions &Options, raw_ostream &Out)
+      : Names(Names), Options(Options), Out(Out) {}
+
+  std::unique_ptr<ASTConsumer>
+    CreateASTConsumer(CompilerInstance &CI, StringRef file) override;
+
+private:
+  Rewriter RewriterForAddSuffix;
+  std::shared_ptr<const NamesFile> Names;
+  AddSuffixOptions Options;
+  raw_ostream &Out;
 };
 
 #endif
@@ -1,9 +1,26 @@
 #ifndef ArgStates_H
 #define ArgStates_H
-// The plugin receives ONE global symbol as input.
-// Since we only need to look at changed entities (and not all
-// symbols as with AddSuffix) the overhead of doing a new
-// run per name is not going to be notable a problem
+// The plugin receives a set of global symbols as input, either with
+// one or more -symbol-name arguments or from a -names-file.
+// All of the symbols are analyzed in the same traversal of the AST
+// and one output file is written per symbol.
+//
+// If ARG_STATES_OUT_LOG is set, the states are instead appended to that
+// file as one JSON record per line (symbol and TU), see appendArgStates().
+// Any number of processes can share the same log, compact_states.py folds
+// it into one output file per symbol.
+//
+// With -cache-dir <dir> the states of every symbol are also stored in a
+// ResultCache, a TU that has not changed since an earlier run is not
+// analyzed again.
+//
+// With -threads <n> the TU is searched for calls to the symbols on n
+// threads, only the functions that contain a call are analyzed.
+//
+// With -call-site-registry <dir> a call in a header is skipped once another
+// TU of the same run has analyzed it, see CallSiteRegistry.hpp. The run is
+// identified by ARG_STATES_RUN_ID, which must be set to the same value for
+// every TU of a run.
 //
 // We want to determine what arguments are used to call each of these
 // functions. Our record of this data will be on the form
@@ -32,46 +49,176 @@
 //
 
 #include "Base.hpp"
+#include "CallSiteRegistry.hpp"
+#include "ResultCache.hpp"
+#include "Stats.hpp"
+
+#include "clang/Analysis/CFG.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+
+// Indexes of the counters and timers in the Stats of each TU
+enum ArgStatesCounter {
+  COUNT_ANY, COUNT_REF, COUNT_INT, COUNT_STR, COUNT_CHR, COUNT_UNARY,
+  COUNT_CACHE_HIT, COUNT_CACHE_MISS, COUNT_SKIPPED, COUNT_SATURATED,
+  COUNT_SHARED
+};
+enum ArgStatesTimer {
+  TIME_FIRST_PASS, TIME_FIRST_RUN, TIME_GET_PARAM, TIME_SECOND_RUN,
+  TIME_OUTPUT
+};
 
 //-----------------------------------------------------------------------------
 // First pass:
 // In the first pass we will determine every call site to
 // a changed function and what arguments the invocations use
 //-----------------------------------------------------------------------------
-class FirstPassMatcher : public MatchFinder::MatchCallback {
+// The innermost call expression (to any function) above a node and the child
+// of that call which the node is located under, i.e. the root of the argument
+// (or callee) subtree that contains the node
+struct CallPosition {
+  const CallExpr* call = nullptr;
+  const Stmt* arg = nullptr;
+};
+
+// An argument which is only a reference to a variable, e.g. foo(x),
+// these are resolved in the second pass
+struct DeclRefArg {
+  // The function that contains the call
+  const FunctionDecl* caller;
+  const FunctionDecl* fnc;
+  const CallExpr* call;
+  const DeclRefExpr* declRef;
+  int paramIndex;
+};
+
+class FirstPassMatcher {
 public:
-  explicit FirstPassMatcher() {}
-  // Defines what types of nodes we we want to match
-  void run(const MatchFinder::MatchResult &) override;
-  void onEndOfTranslationUnit() override {};
+  FirstPassMatcher(llvm::UniqueStringSaver &strings, Stats &stats)
+    : strings(strings), stats(stats) {}
+  // Classifies one expression under a call to one of the symbols
+  void run(ASTContext &ctx, const CallExpr* call, const FunctionDecl* fnc,
+    const Expr* expr, const CallPosition &position,
+    const FunctionDecl* caller);
+  void dumpUnhandledLeaves();
 
-  std::vector<ArgState> argumentStates;
-  std::string filename;
+  /// The number of symbols for which every parameter is nondet(), the
+  /// states of these can no longer change and their calls are skipped
+  unsigned saturatedCount() const { return this->saturated.size(); }
+
+  SymbolStates argumentStates;
+  std::vector<DeclRefArg> declRefArgs;
 private:
-  void getCallPath(DynTypedNode &parent, std::string bindName,
-    std::vector<DynTypedNode> &callPath);
-  void handleLiteralMatch(variants value,
-    StateType matchedType, const CallExpr* call, const Expr* matchedExpr);
-  std::tuple<std::string,int> getParam(const CallExpr* matchedCall,
-   std::vector<DynTypedNode>& callPath,
-   const char* bindName);
+  std::vector<ArgState>& getStates(const FunctionDecl* fnc);
+  void handleAnyMatch(const CallExpr* call, const FunctionDecl* fnc,
+    const Expr* anyArg);
+  template<typename T>
+  void handleLiteralMatch(T value,
+    StateType matchedType, const CallExpr* call, const FunctionDecl* fnc,
+    const Expr* matchedExpr);
+  std::tuple<StringRef,int> getParam(const CallExpr* matchedCall);
+  void checkSaturated(const FunctionDecl* fnc);
+
+  // String states and parameter names are interned in the pool of the TU
+  llvm::UniqueStringSaver &strings;
+  Stats &stats;
 
   SourceManager* srcMgr;
-  BoundNodes::IDToNodeMap nodeMap;
+  CallPosition position;
+  const FunctionDecl* caller = nullptr;
+  llvm::StringSet<> saturated;
+
+  // The number of argument leaves with a node type that we cannot
+  // classify, indexed by Stmt::StmtClass
+  uint unhandledLeaves[Stmt::lastStmtConstant + 1] = {};
+  const char* unhandledNames[Stmt::lastStmtConstant + 1] = {};
 
-  // Holds contextual information about the AST, this allows
-  // us to determine e.g. the parents of a matched node
+  // Holds contextual information about the AST
   ASTContext* ctx;
 };
 
+// Walks the TU once and hands every expression below a call to one of the
+// symbols to the FirstPassMatcher, in the same order as a MatchFinder would
+class FirstPassVisitor : public RecursiveASTVisitor<FirstPassVisitor> {
+public:
+  FirstPassVisitor(ASTContext &ctx, FirstPassMatcher &matchHandler,
+    const llvm::StringSet<> &symbolNames, Stats &stats,
+    CallSiteRegistry* registry = nullptr)
+    : ctx(ctx), matchHandler(matchHandler), symbolNames(symbolNames),
+      stats(stats), registry(registry) {}
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+  bool shouldVisitImplicitCode() const { return true; }
+
+  bool TraverseDecl(Decl* decl);
+  bool TraverseStmt(Stmt* stmt, DataRecursionQueue* queue = nullptr);
+
+private:
+  ASTContext &ctx;
+  FirstPassMatcher &matchHandler;
+  const llvm::StringSet<> &symbolNames;
+  Stats &stats;
+  CallSiteRegistry* registry;
+
+  // The innermost call to one of the symbols that encloses the current node,
+  // 'skipCall' is set if the call has been analyzed by another TU
+  const CallExpr* call = nullptr;
+  const FunctionDecl* fnc = nullptr;
+  bool skipCall = false;
+
+  // The argument subtree of the innermost call above the current node,
+  // this is tracked for calls to every function
+  CallPosition position;
+
+  // The parent of the current node, 'parent' is a nullptr when the
+  // parent is a declaration
+  const Stmt* parent = nullptr;
+  const Decl* parentDecl = nullptr;
+
+  // The body of the innermost function that is being traversed
+  const Stmt* functionBody = nullptr;
+  const FunctionDecl* caller = nullptr;
+};
+
+// Searches the declarations below a node for a call to one of the symbols,
+// this only reads from the AST and is used to find the top-level
+// declarations that the FirstPassVisitor needs to walk
+class TargetCallFinder : public RecursiveASTVisitor<TargetCallFinder> {
+public:
+  explicit TargetCallFinder(const llvm::StringSet<> &symbolNames)
+    : symbolNames(symbolNames) {}
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+  bool shouldVisitImplicitCode() const { return true; }
+
+  bool VisitCallExpr(CallExpr* call);
+
+  bool found = false;
+private:
+  const llvm::StringSet<> &symbolNames;
+};
+
+// With more than one thread, the top-level declarations are searched for
+// calls to the symbols in parallel (see Shards.hpp) and only the ones
+// that contain a call are visited
 class FirstPassASTConsumer : public ASTConsumer {
 public:
-  FirstPassASTConsumer(std::string symbolName);
+  FirstPassASTConsumer(const std::vector<std::string> &symbolNames,
+    llvm::UniqueStringSaver &strings, Stats &stats, unsigned threads = 1,
+    CallSiteRegistry* registry = nullptr);
   void HandleTranslationUnit(ASTContext &ctx) override ;
 
   FirstPassMatcher matchHandler;
 private:
-  MatchFinder finder;
+  llvm::StringSet<> symbolNames;
+  Stats &stats;
+  unsigned threads;
+  CallSiteRegistry* registry;
 };
 
 
@@ -80,50 +227,156 @@ private:
 // In the second pass we will consider all of the DECLREF arguments
 // found from the previous pass and determine their state space
 // before the function call occurs
+//
+// This is a reaching definitions analysis over the CFG of the calling
+// function, if every definition of the variable that reaches the call
+// assigns a literal, the literals are added as states and the argument
+// is no longer considered nondet(). Local variables (and parameters)
+// which never have their address taken are the only ones considered.
+//
+// The CFG of a function is only built once it has a DECLREF argument
+// that needs to be resolved, and is shared by every call in the function.
 //-----------------------------------------------------------------------------
-class SecondPassMatcher : public MatchFinder::MatchCallback {
+class SecondPassMatcher {
 public:
-  explicit SecondPassMatcher() {}
-  void run(const MatchFinder::MatchResult &) override;
-  void onEndOfTranslationUnit() override {};
+  SecondPassMatcher(llvm::UniqueStringSaver &strings, Stats &stats)
+    : strings(strings), stats(stats) {}
+  void run(ASTContext &ctx, const DeclRefArg &arg);
 
-  std::vector<ArgState> argumentStates;
+  SymbolStates argumentStates;
 private:
-  SourceManager* srcMgr;
-  BoundNodes::IDToNodeMap nodeMap;
+  // The definitions of a variable that reach a point in the CFG,
+  // 'unknown' is set if any of them does not assign a known value
+  // (including the value that a variable has on entry)
+  struct ReachingDefs {
+    llvm::SmallPtrSet<const Expr*, 4> values;
+    bool unknown = false;
+
+    bool merge(const ReachingDefs &other);
+  };
+
+  // A definition of a variable at an element of a CFGBlock,
+  // 'value' is a nullptr if the assigned value is unknown
+  struct Def {
+    const VarDecl* var;
+    uint index;
+    const Expr* value;
+  };
+
+  struct FunctionCFG {
+    std::unique_ptr<CFG> cfg;
+    // The block ID and element index of every statement in the CFG
+    llvm::DenseMap<const Stmt*, std::pair<uint, uint>> elements;
+    // The definitions in each block, indexed by block ID
+    std::vector<llvm::SmallVector<Def, 2>> defs;
+    // Variables that have their address taken
+    llvm::DenseSet<const VarDecl*> escaped;
+    // The definitions that reach the start of each block
+    llvm::DenseMap<const VarDecl*, std::vector<ReachingDefs>> blockDefs;
+  };
+
+  FunctionCFG* getCFG(const FunctionDecl* caller);
+  const std::vector<ReachingDefs>& getBlockDefs(FunctionCFG &function,
+    const VarDecl* var);
+  bool getReachingDefs(FunctionCFG &function, const VarDecl* var,
+    const DeclRefArg &arg, ReachingDefs &result);
+  bool addStates(ArgState &argState, const ReachingDefs &defs);
+
+  // String states are interned in the pool of the TU
+  llvm::UniqueStringSaver &strings;
+  Stats &stats;
 
-  // Holds contextual information about the AST, this allows
-  // us to determine e.g. the parents of a matched node
+  // A nullptr is stored for functions without a CFG
+  llvm::DenseMap<const FunctionDecl*, std::unique_ptr<FunctionCFG>> cfgs;
+
+  // Holds contextual information about the AST
   ASTContext* ctx;
 };
 
 class SecondPassASTConsumer : public ASTConsumer {
 public:
-  SecondPassASTConsumer(std::string symbolName);
+  SecondPassASTConsumer(std::vector<DeclRefArg> declRefArgs,
+    llvm::UniqueStringSaver &strings, Stats &stats);
   void HandleTranslationUnit(ASTContext &ctx) override ;
 
   SecondPassMatcher matchHandler;
 
 private:
-  MatchFinder finder;
+  std::vector<DeclRefArg> declRefArgs;
 };
 
 //-----------------------------------------------------------------------------
 // ASTConsumer driver for each pass
 //  https://stackoverflow.com/a/46738273/9033629
 //-----------------------------------------------------------------------------
+// Write the states of a symbol as one line of JSON, this is the format of
+// the log and of the entries in the ResultCache
+void writeRecord(llvm::raw_ostream &os, const std::string &symbolName,
+  llvm::StringRef tuPath, const std::vector<ArgState> &argumentStates);
+
 class ArgStatesASTConsumer : public ASTConsumer {
 public:
-  ArgStatesASTConsumer(std::string symbolName) ;
+  ArgStatesASTConsumer(std::vector<std::string> symbolNames,
+    unsigned threads = 1) ;
   ~ArgStatesASTConsumer();
   void HandleTranslationUnit(ASTContext &ctx) override;
 
+  /// Symbols with an entry in the cache are not analyzed,
+  /// the results of the other symbols are added to it
+  void setResultCache(std::unique_ptr<ResultCache> cache) {
+    this->resultCache = std::move(cache);
+  }
+
+  /// Calls in headers that another TU has analyzed are skipped
+  void setCallSiteRegistry(std::unique_ptr<CallSiteRegistry> registry) {
+    this->registry = std::move(registry);
+  }
+
 private:
-  void dumpArgStates();
-  std::string getOutputPath();
-  std::string symbolName;
+  void analyze(ASTContext &ctx, const std::vector<std::string> &symbolNames);
+  bool dumpArgStates();
+  bool dumpArgStates(const std::string &symbolName,
+    const std::vector<ArgState> &argumentStates);
+  bool appendArgStates(const char *logPath);
+  std::string getOutputPath(const std::string &symbolName);
+  std::vector<std::string> symbolNames;
+  unsigned threads;
   std::string filename;
-  std::vector<ArgState> argumentStates;
+  std::string tuPath;
+  Stats stats;
+  std::unique_ptr<ResultCache> resultCache;
+  std::unique_ptr<CallSiteRegistry> registry;
+  bool hasErrors = false;
+
+  // Every string in the argumentStates is owned by this pool, it is
+  // declared first so that it is destroyed last
+  llvm::BumpPtrAllocator allocator;
+  llvm::UniqueStringSaver strings{allocator};
+  SymbolStates argumentStates;
+};
+
+//-----------------------------------------------------------------------------
+// FrontendAction
+// Used when running ArgStates through LibTooling rather than as a plugin,
+// the result cache is only used if a cacheDir is given and the call site
+// registry if a registryDir is given
+//-----------------------------------------------------------------------------
+class ArgStatesFrontendAction : public ASTFrontendAction {
+public:
+  ArgStatesFrontendAction(std::vector<std::string> symbolNames,
+      std::string cacheDir, unsigned threads = 1,
+      std::string registryDir = "")
+      : symbolNames(symbolNames), cacheDir(cacheDir), threads(threads),
+        registryDir(registryDir) {}
+
+  std::unique_ptr<ASTConsumer>
+    CreateASTConsumer(CompilerInstance &CI, StringRef file) override;
+
+private:
+  std::vector<std::string> symbolNames;
+  std::string cacheDir;
+  unsigned threads;
+  std::string registryDir;
 };
 
 #endif
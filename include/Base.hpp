@@ -9,28 +9,79 @@
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
 #include <set>
-#include <variant>
 #include <tuple>
 
 
 #define OUTPUT_DIR_ENV "ARG_STATES_OUT_DIR"
+#define OUTPUT_LOG_ENV "ARG_STATES_OUT_LOG"
 #define DEBUG_ENV "DEBUG_AST"
 #define INDENT "  "
 
+/// The environment is only read once, rather than for every message
+inline bool isDebug() {
+  static const bool debug = getenv(DEBUG_ENV) != NULL;
+  return debug;
+}
+
 #define PRINT_ERR(msg)                              llvm::errs() << \
                             "\033[31m!>\033[0m " << msg << "\n"
-#define PRINT_WARN(msg) if (getenv(DEBUG_ENV)!=NULL) llvm::errs() << \
+#define PRINT_WARN(msg) if (isDebug()) llvm::errs() << \
                             "\033[33m!>\033[0m " << msg << "\n"
-#define PRINT_INFO(msg) if (getenv(DEBUG_ENV)!=NULL) llvm::errs() << \
+#define PRINT_INFO(msg) if (isDebug()) llvm::errs() << \
                             "\033[34m!>\033[0m " << msg << "\n"
 typedef unsigned uint;
-typedef std::variant<unsigned int,uint64_t,std::string> variants;
+
+//-----------------------------------------------------------------------------
+// Set stored as a sorted vector
+// Unlike std::set there is no heap node per element. Node ids are
+// usually inserted in increasing order (they follow the traversal order)
+// in which case an insertion is an append
+//-----------------------------------------------------------------------------
+template<typename T, unsigned N = 4>
+class FlatSet {
+public:
+  typedef typename llvm::SmallVector<T, N>::const_iterator const_iterator;
+
+  bool insert(const T &value) {
+    if (this->items.empty() || this->items.back() < value) {
+      this->items.push_back(value);
+      return true;
+    }
+    auto it = std::lower_bound(this->items.begin(), this->items.end(), value);
+    if (*it == value) {
+      return false;
+    }
+    this->items.insert(it, value);
+    return true;
+  }
+
+  size_t erase(const T &value) {
+    auto it = std::lower_bound(this->items.begin(), this->items.end(), value);
+    if (it == this->items.end() || *it != value) {
+      return 0;
+    }
+    this->items.erase(it);
+    return 1;
+  }
+
+  size_t size() const { return this->items.size(); }
+  bool empty() const { return this->items.empty(); }
+  const_iterator begin() const { return this->items.begin(); }
+  const_iterator end() const { return this->items.end(); }
+
+private:
+  llvm::SmallVector<T, N> items;
+};
 
 //-----------------------------------------------------------------------------
 // Argument state structures
@@ -46,18 +97,30 @@ struct ArgState {
 
   // Populated with the (leaf) node ID of every expr that is passed
   // to this function parameter in the current TU
-  std::set<uint64_t> ids;
+  FlatSet<uint64_t> ids;
 
-  // We only need one set of states for each Arg
-  // This solution with variant requires C++17
-  // Characters a represented as unsigned int
-  std::set<variants> states;
+  // We only need one set of states for each Arg, the type decides which
+  // one is used: STR values are kept in 'strStates' and INT, UNARY and
+  // CHR values (characters are represented as unsigned int)
+  // in 'intStates'
+  //
+  // Strings are references into the string pool of the TU
+  FlatSet<uint64_t> intStates;
+  FlatSet<llvm::StringRef> strStates;
+
+  void addState(uint64_t value) { this->intStates.insert(value); }
+  void addState(llvm::StringRef value) { this->strStates.insert(value); }
 
   // Will be empty for parameters without names in their declaration, e.g.
   //  foo(int, char*)
-  std::string paramName;
+  llvm::StringRef paramName;
 };
 
+// The argument states of every analyzed symbol, keyed by the symbol name
+// (std::less<> allows lookups with a StringRef)
+typedef std::map<std::string, std::vector<ArgState>, std::less<>>
+  SymbolStates;
+
 using namespace clang;
 using namespace ast_matchers;
 
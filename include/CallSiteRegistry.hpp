@@ -0,0 +1,67 @@
+#ifndef CallSiteRegistry_H
+#define CallSiteRegistry_H
+
+#include "Base.hpp"
+
+#include "clang/Basic/SourceLocation.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <string>
+#include <vector>
+
+// The plugin keeps the registry of each run in its own subdirectory
+#define RUN_ID_ENV "ARG_STATES_RUN_ID"
+
+//-----------------------------------------------------------------------------
+// Registry of the calls in headers that have been analyzed
+// A call inside of a header, e.g. in a static inline function, is seen again
+// by every TU that includes the header. Once a TU has written its states,
+// the call sites in headers that it analyzed are recorded in a directory that
+// is shared between every TU of a run, later TUs skip these calls. States
+// are joined over every TU afterwards, i.e. the joined output is the same as
+// without the registry.
+//
+// A site is only recorded by a TU that completed without errors, a TU that
+// fails or crashes never hides a call from the other TUs. TUs that run
+// concurrently can both analyze the same site, which is harmless.
+//
+// A call site is identified by the content hash of its file, its offset, the
+// hash of the compiler invocation and the call itself (as printed after
+// macro expansion), a header that expands differently in two TUs gives two
+// call sites. A recorded site is an empty marker file named after its hash.
+//
+// The plugin places the markers in a subdirectory named after RUN_ID_ENV,
+// the markers of an earlier run are never seen by a later one.
+//-----------------------------------------------------------------------------
+class CallSiteRegistry {
+public:
+  CallSiteRegistry(std::string directory, std::string invocationHash)
+    : directory(directory), invocationHash(invocationHash) {}
+
+  /// Returns false if the call is located in a header and has already been
+  /// recorded by another TU. Calls in the main file are always analyzed
+  bool claim(ASTContext &ctx, const CallExpr* call,
+    llvm::StringRef symbolName);
+
+  /// Record the header call sites that were analyzed by the current TU,
+  /// called once its states have been written
+  void commit();
+
+  /// True if a call to the symbol has been skipped in the current TU
+  bool hasSkipped(llvm::StringRef symbolName) const {
+    return this->skipped.count(symbolName) > 0;
+  }
+
+private:
+  const std::string& getFileHash(const SourceManager &srcMgr, FileID file);
+
+  std::string directory;
+  std::string invocationHash;
+  llvm::DenseMap<FileID, std::string> fileHashes;
+  llvm::StringSet<> skipped;
+  // The markers of the sites that are analyzed by the current TU
+  std::vector<std::string> claimed;
+};
+
+#endif
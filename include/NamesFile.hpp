@@ -0,0 +1,57 @@
+#ifndef NamesFile_H
+#define NamesFile_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Regex.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Names file loader
+// The file is memory mapped and every entry is kept as a StringRef into the
+// mapped buffer, i.e. the entries are never copied.
+//
+// Each line holds one entry, surrounding whitespace and empty lines are
+// ignored and duplicate entries are only stored once. Entries that contain
+// any of the glob characters '*', '?' or '[' are treated as patterns, e.g.
+//
+//  onig_*
+//
+// All patterns are compiled into one (anchored) regex alternation
+//-----------------------------------------------------------------------------
+class NamesFile {
+public:
+  /// Returns false and sets 'error' if the file could not be read or
+  /// if the patterns in it are invalid
+  bool read(llvm::StringRef filename, std::string &error);
+
+  /// The (deduplicated) entries that are not patterns
+  llvm::ArrayRef<llvm::StringRef> names() const { return this->exactNames; }
+
+  /// The raw glob entries
+  llvm::ArrayRef<llvm::StringRef> patterns() const { return this->globs; }
+
+  bool hasPatterns() const { return !this->globs.empty(); }
+
+  /// Returns true if the given name is matched by any of the patterns
+  bool matchesPattern(llvm::StringRef name) const;
+
+private:
+  static bool isPattern(llvm::StringRef entry);
+  static void globToRegex(llvm::StringRef glob, std::string &regex);
+
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::vector<llvm::StringRef> exactNames;
+  std::vector<llvm::StringRef> globs;
+
+  // The literal characters that precede the first wildcard of each
+  // pattern, checked before falling back to the regex
+  std::vector<llvm::StringRef> globPrefixes;
+  std::unique_ptr<llvm::Regex> patternRegex;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef ResultCache_H
+#define ResultCache_H
+
+#include "Base.hpp"
+
+#include "llvm/Support/StringSaver.h"
+
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// On-disk cache of ArgStates results
+// The states of every symbol are stored once per TU, a later run over an
+// unchanged TU reads them from the cache instead of traversing the AST.
+//
+// Entries are keyed by the content of every file that the TU read (i.e. the
+// input of the preprocessor), the path of the main file, the hash of the
+// compiler invocation (macros, include paths, language options, target), the
+// version of clang and the symbol. A symbol that is never called in the TU
+// is stored as an entry without params, so that it also counts as a hit.
+//
+// Every entry is written to a temporary file that is renamed into place,
+// concurrent writers of the same entry store the same content and readers
+// never observe a partially written entry.
+//-----------------------------------------------------------------------------
+class ResultCache {
+public:
+  ResultCache(std::string directory, std::string invocationHash)
+    : directory(directory), invocationHash(invocationHash) {}
+
+  /// Returns the hash of the current TU, every entry of the TU is derived
+  /// from it (an empty string is returned if a file cannot be read)
+  std::string getKey(ASTContext &ctx, llvm::StringRef tuPath);
+
+  /// Returns the path of the entry for a symbol in the TU with the given key
+  std::string entryPath(llvm::StringRef key, llvm::StringRef symbolName);
+
+  /// Read the states of an entry, the strings of the states are saved in
+  /// the given pool. Returns false if the entry does not exist or is invalid
+  bool load(const std::string &path, llvm::StringRef symbolName,
+    llvm::UniqueStringSaver &strings, std::vector<ArgState> &argumentStates);
+
+  void store(const std::string &path, llvm::StringRef symbolName,
+    llvm::StringRef tuPath, const std::vector<ArgState> &argumentStates);
+
+private:
+  std::string directory;
+  std::string invocationHash;
+};
+
+#endif
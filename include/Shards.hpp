@@ -0,0 +1,34 @@
+#ifndef Shards_H
+#define Shards_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Sharded search over the top-level declarations of a TU
+// The matchers of both plugins are not safe to run concurrently, the
+// ASTContext and SourceManager memoize queries (parent maps, type sizes,
+// FileID lookups) and there is only one traversal scope per ASTContext.
+//
+// Walking the AST is read-only however, the declarations are split into
+// shards that are searched on separate threads for the nodes that a plugin
+// is interested in. The plugin then only traverses the declarations that
+// contain such a node (in their original order) on the current thread,
+// i.e. the output is the same as that of a full traversal.
+//-----------------------------------------------------------------------------
+
+/// Returns the declarations for which 'contains' returns true, in their
+/// original order. 'contains' is called from several threads at once and
+/// must only read from the AST.
+///
+/// Every declaration is returned if the AST has an external source, the
+/// declarations of a loaded AST are deserialized lazily
+std::vector<clang::Decl*> filterDecls(clang::ASTContext &ctx,
+  llvm::ArrayRef<clang::Decl*> decls, unsigned threads,
+  llvm::function_ref<bool(clang::Decl*)> contains);
+
+#endif
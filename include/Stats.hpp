@@ -0,0 +1,76 @@
+#ifndef Stats_H
+#define Stats_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/TimeProfiler.h"
+
+#include <chrono>
+#include <cstdint>
+
+// Print a summary line for every TU to stderr if this is set
+#define STATS_ENV "PLUGIN_STATS"
+
+//-----------------------------------------------------------------------------
+// Per-TU instrumentation
+// Each plugin defines an enum of counters and an enum of timers together with
+// a name for every entry, the enums are used to index the Stats.
+//
+// Counters are always maintained (they are a single increment). Every timed
+// scope is added to the -ftime-trace output of clang when it is enabled, the
+// totals that are shown in the summary are only measured if STATS_ENV is set.
+// The summary is printed on one line, e.g.
+//
+//  stats> ArgStates /src/regcomp.c: ANY=812 REF=0 ... FirstPass::run=1.204ms
+//
+//-----------------------------------------------------------------------------
+class Stats {
+public:
+  Stats(const char *plugin, llvm::ArrayRef<const char*> counterNames,
+        llvm::ArrayRef<const char*> timerNames)
+    : plugin(plugin), counterNames(counterNames), timerNames(timerNames),
+      counters(counterNames.size(), 0),
+      timers(timerNames.size(), std::chrono::nanoseconds::zero()) {}
+
+  /// True if STATS_ENV is set, the environment is only read once
+  static bool enabled();
+
+  void count(unsigned counter) { this->counters[counter]++; }
+
+  /// Print the counters and timer totals for the given TU, nothing is
+  /// printed unless STATS_ENV is set
+  void print(llvm::StringRef tu) const;
+
+  // Records the time spent in the enclosing scope
+  class Timer {
+  public:
+    Timer(Stats &stats, unsigned timer)
+      : trace(stats.timerNames[timer]), stats(stats), timer(timer) {
+      if (Stats::enabled()) {
+        this->start = std::chrono::steady_clock::now();
+      }
+    }
+    ~Timer() {
+      if (Stats::enabled()) {
+        this->stats.timers[this->timer] +=
+          std::chrono::steady_clock::now() - this->start;
+      }
+    }
+
+  private:
+    llvm::TimeTraceScope trace;
+    Stats &stats;
+    unsigned timer;
+    std::chrono::steady_clock::time_point start;
+  };
+
+private:
+  const char *plugin;
+  llvm::ArrayRef<const char*> counterNames;
+  llvm::ArrayRef<const char*> timerNames;
+  llvm::SmallVector<uint64_t, 8> counters;
+  llvm::SmallVector<std::chrono::nanoseconds, 4> timers;
+};
+
+#endif
@@ -10,13 +10,14 @@
 namespace util {
   
   const Stmt* getFirstLeaf(const Stmt* stmt, ASTContext* ctx);
+  const Expr* ignoreCasts(const Expr* expr, ASTContext* ctx);
 
   // Template functions need to be visible to every TU that uses them and
   // one must therefore have the implementation inside of a header
   template<typename T>
-  void dumpMatch(std::string type, T msg, int pass, SourceManager* srcMgr, 
+  void dumpMatch(llvm::StringRef type, T msg, int pass, SourceManager* srcMgr, 
   SourceLocation srcLocation) {
-    if(getenv(DEBUG_ENV)!=NULL) {
+    if(isDebug()) {
       const auto location = srcMgr->getFileLoc(srcLocation);
       llvm::errs() << "\033[35m" << pass << "\033[0m: " << type << "> " 
         << location.printToString(*srcMgr)
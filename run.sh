@@ -7,6 +7,18 @@ usage="usage: $(basename $0) <file.c>"
 
 [ -n "$1" ] && TARGET_FILE=$1
 
+# stdout:       the rewritten main file is written to stdout
+# replacements: the edits in every file are written to stdout as YAML that
+#               can be applied with clang-apply-replacements
+# in-place:     every modified file is overwritten
+OUTPUT_MODE=${OUTPUT_MODE:-stdout}
+
+# Only the main file is written in stdout mode, there is no need to
+# look for matches inside of the included headers
+scope_flags=""
+[ "$OUTPUT_MODE" = stdout ] &&
+	scope_flags="-plugin-arg-AddSuffix -main-file-only"
+
 # https://clang.llvm.org/docs/FAQ.html#id2
 # The -cc1 flag is used to invoke the clang 'frontend', using only the frontend
 # infers that default options are lost, errors like 
@@ -35,21 +47,19 @@ for flag in [ $frontend_flags ]:
 print(out)
 EOF
 
-# To allow us to replace references to global symbols inside macros
-# we first preprocess the file, only expanding #define statements
-# In oniguruma this results in certain functions gaining a 'onig_' prefix...
-# due to a #define in regint.h
+# References inside of macros are renamed by the plugin at the location
+# where they are spelled, i.e. the #define body or the macro argument.
+# In stdout mode only the main file is written however, a reference in a
+# #define from a header (e.g. regint.h in oniguruma) would never be renamed.
+# For stdout mode we therefore first preprocess the file, only expanding
+# #define statements, the other modes pass the file as is
 #
 # Using the --passthru-includes option avoids expansion of the #include lines
-# in the output but it still processes defines in these headers. The .h files
-# could contain #macros so this is preferable.
-#
-# The question is if compilation will still go through with the normal
-# build process with the header included...
-#
-# I have a feeling it will since any macros in the .c file will simply already
-# have been expanded...
+# in the output but it still processes defines in these headers.
 #   https://stackoverflow.com/q/65045678/9033629
+if [ -z "$EXPAND" ]; then
+	[ "$OUTPUT_MODE" = stdout ] && EXPAND=true || EXPAND=false
+fi
 
 if $EXPAND; then
 	expand_macros(){
@@ -77,6 +87,8 @@ clang -cc1 -load "$PLUGIN" \
 	-plugin AddSuffix \
 	-plugin-arg-AddSuffix -names-file -plugin-arg-AddSuffix $REPLACE_FILE  \
 	-plugin-arg-AddSuffix -suffix -plugin-arg-AddSuffix _old_aaaaaaa \
+	-plugin-arg-AddSuffix -output-mode -plugin-arg-AddSuffix $OUTPUT_MODE \
+	$scope_flags \
 	$(cat $isystem_flags) \
 	$expanded_file -I $INCLUDE_DIR -I/usr/include
 
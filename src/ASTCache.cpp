@@ -0,0 +1,158 @@
+#include "ASTCache.hpp"
+
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <utime.h>
+#include <vector>
+
+using namespace clang;
+using namespace llvm;
+
+std::unique_ptr<ASTUnit> ASTCache::get(
+ const tooling::CompilationDatabase &db, StringRef file) {
+  const auto commands = db.getCompileCommands(file);
+  if (commands.empty()) {
+    errs() << "No compile command for " << file << "\n";
+    return nullptr;
+  }
+
+  // Only the first command is used if there are several for the same file
+  const std::string path = this->entryPath(commands[0]);
+
+  if (!path.empty() && sys::fs::exists(path)) {
+    if (auto unit = this->load(path, commands[0])) {
+      this->hits++;
+      return unit;
+    }
+  }
+
+  this->misses++;
+  auto unit = this->build(db, file);
+  if (!unit) {
+    return nullptr;
+  }
+
+  // ASTUnit::Save() writes to a temporary file that is renamed into place,
+  // concurrent runs never observe a partially written entry.
+  // TUs with errors are analyzed but never cached
+  if (!path.empty() && !unit->getDiagnostics().hasErrorOccurred() &&
+      !unit->Save(path)) {
+    utime(path.c_str(), nullptr);
+    this->evict();
+  }
+  return unit;
+}
+
+void ASTCache::evict() {
+  struct Entry {
+    std::string path;
+    uint64_t size;
+    sys::TimePoint<> lastUsed;
+  };
+  std::vector<Entry> entries;
+  uint64_t totalSize = 0;
+  std::error_code ec;
+
+  for (sys::fs::directory_iterator it(this->directory, ec), end;
+       it != end && !ec; it.increment(ec)) {
+    if (sys::path::extension(it->path()) != ".ast") {
+      continue;
+    }
+    sys::fs::file_status status;
+    if (sys::fs::status(it->path(), status)) {
+      continue;
+    }
+    entries.push_back({it->path(), status.getSize(),
+                       status.getLastModificationTime()});
+    totalSize += status.getSize();
+  }
+
+  if (totalSize <= this->maxBytes) {
+    return;
+  }
+
+  std::sort(entries.begin(), entries.end(),
+    [](const Entry &a, const Entry &b){ return a.lastUsed < b.lastUsed; });
+
+  for (const auto &entry : entries) {
+    if (totalSize <= this->maxBytes) {
+      break;
+    }
+    if (!sys::fs::remove(entry.path)) {
+      totalSize -= entry.size;
+    }
+  }
+}
+
+/// Returns the path of the cache entry for a compile command
+/// (an empty string is returned if the main file cannot be read)
+std::string ASTCache::entryPath(const tooling::CompileCommand &command) {
+  SmallString<256> source(command.Filename);
+  sys::fs::make_absolute(command.Directory, source);
+
+  auto buffer = MemoryBuffer::getFile(source);
+  if (!buffer) {
+    return std::string();
+  }
+
+  MD5 hash;
+  hash.update(getClangFullVersion());
+  hash.update(StringRef("\0", 1));
+  hash.update(command.Directory);
+  for (const auto &arg : command.CommandLine) {
+    hash.update(StringRef("\0", 1));
+    hash.update(arg);
+  }
+  hash.update(StringRef("\0", 1));
+  hash.update((*buffer)->getBuffer());
+
+  MD5::MD5Result result;
+  hash.final(result);
+
+  SmallString<256> path(this->directory);
+  sys::path::append(path, result.digest().str() + ".ast");
+  return std::string(path.str());
+}
+
+std::unique_ptr<ASTUnit> ASTCache::load(const std::string &path,
+ const tooling::CompileCommand &command) {
+  // A stale entry is expected (e.g. after a header has been modified)
+  // and should not be reported, the TU is parsed again instead
+  auto diags = CompilerInstance::createDiagnostics(new DiagnosticOptions(),
+    new IgnoringDiagConsumer());
+
+  FileSystemOptions fsOpts;
+  fsOpts.WorkingDir = command.Directory;
+
+  auto unit = ASTUnit::LoadFromASTFile(path,
+    this->pchOperations.getRawReader(), ASTUnit::LoadEverything,
+    diags, fsOpts);
+
+  if (!unit || diags->hasErrorOccurred()) {
+    return nullptr;
+  }
+
+  // Mark the entry as recently used
+  utime(path.c_str(), nullptr);
+  return unit;
+}
+
+std::unique_ptr<ASTUnit> ASTCache::build(
+ const tooling::CompilationDatabase &db, StringRef file) {
+  tooling::ClangTool tool(db, {std::string(file)});
+  std::vector<std::unique_ptr<ASTUnit>> units;
+
+  tool.buildASTs(units);
+  if (units.empty()) {
+    return nullptr;
+  }
+  return std::move(units[0]);
+}
@@ -14,6 +14,7 @@
 //
 //==============================================================================
 #include "AddSuffix.hpp"
+#include "Shards.hpp"
 
 #include "clang/AST/Expr.h"
 #include "clang/AST/ExprCXX.h"
@@ -23,9 +24,10 @@
 #include "clang/Frontend/FrontendPluginRegistry.h"
 #include "clang/Tooling/Refactoring/Rename/RenamingAction.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/SmallString.h"
+#include <algorithm>
 #include <string>
-#include <fstream>
-#include <unordered_set>
+#include <tuple>
 
 using namespace clang;
 using namespace ast_matchers;
@@ -36,45 +38,50 @@ using namespace ast_matchers;
 //-----------------------------------------------------------------------------
 
 void AddSuffixMatcher::replaceInDeclMatch(
-  const MatchFinder::MatchResult &result, std::string bindName) {
+  const MatchFinder::MatchResult &result, StringRef bindName,
+  AddSuffixCounter counter) {
 
     const DeclaratorDecl *node = result.Nodes
       .getNodeAs<DeclaratorDecl>(bindName);
 
     if (node) {
-      auto nodeName = std::string(node->getName().str());
-      this->replaceInMatch(result, bindName, node->getLocation(), nodeName);
+      this->Statistics.count(counter);
+      this->replaceInMatch(result, bindName, node->getLocation(),
+                           node->getName());
     }
 }
 
 void AddSuffixMatcher::replaceInDeclRefMatch(
-    const MatchFinder::MatchResult &result, std::string bindName) {
+    const MatchFinder::MatchResult &result, StringRef bindName,
+    AddSuffixCounter counter) {
 
     const DeclRefExpr *node = result.Nodes
       .getNodeAs<DeclRefExpr>(bindName);
     
     if (node) {
-      auto nodeName = std::string(node->getDecl()->getName().str());
-      this->replaceInMatch(result, bindName, node->getExprLoc(), nodeName);
+      this->Statistics.count(counter);
+      this->replaceInMatch(result, bindName, node->getExprLoc(),
+                           node->getDecl()->getName());
     }
 }
 
 void AddSuffixMatcher::replaceInMatch(
-    const MatchFinder::MatchResult &result, std::string bindName,
-    SourceRange srcRange, std::string nodeName) {
+    const MatchFinder::MatchResult &result, StringRef bindName,
+    SourceLocation location, StringRef nodeName) {
 
-    const SourceManager* mgr = &(this->AddSuffixRewriter.getSourceMgr());
-    const std::string location = std::string(srcRange.printToString(*mgr));
-
-    if (this->renamedLocations.find(location) == 
-	this->renamedLocations.end() ) {
-      // If the other matcher has already performed a replacement
-      // do not add a suffix agian
-      auto newName = nodeName + this->Suffix;
+    if (location.isMacroID()) {
+      this->addMacroEdit(location, nodeName);
+      return;
+    }
 
-      this->AddSuffixRewriter.ReplaceText(srcRange, newName);
-      this->renamedLocations.insert(location);
+    // Matches from a header that is included inside of a declaration in
+    // the main file are left as they are
+    if (this->MainFileEdits && !this->AddSuffixRewriter.getSourceMgr()
+                                    .isWrittenInMainFile(location)) {
+      return;
+    }
 
+    if (this->replaceAt(location, nodeName)) {
       #if DEBUG_AST
       llvm::errs() << "\033[33m!>\033[0m " << bindName << ": " <<
 	nodeName << "\n";
@@ -87,18 +94,191 @@ void AddSuffixMatcher::replaceInMatch(
     }
 }
 
+/// Add the suffix to the identifier at a file location, returns false if the
+/// token has already been renamed
+bool AddSuffixMatcher::replaceAt(SourceLocation location, StringRef nodeName) {
+    // The token at the location is the identifier itself, so its
+    // length is known without lexing
+    const unsigned begin = location.getRawEncoding();
+    const unsigned end   = begin + nodeName.size() - 1;
+
+    // The matchers overlap, e.g. a VarDecl is also a DeclaratorDecl,
+    // so the same token is frequently encountered more than once
+    const auto overlap = this->RenamedRanges.find(begin);
+
+    if (overlap.valid() && overlap.start() <= end) {
+      return false;
+    }
+
+    SmallString<64> newName(nodeName);
+    newName += this->Suffix;
+
+    if (!this->AddSuffixRewriter.ReplaceText(location, nodeName.size(),
+                                             newName)) {
+      const auto decomposed = this->AddSuffixRewriter.getSourceMgr()
+                                .getDecomposedLoc(location);
+      this->Edits.push_back({decomposed.first, decomposed.second,
+                             (unsigned)nodeName.size(), newName.str().str()});
+    }
+    this->RenamedRanges.insert(begin, end, true);
+    return true;
+}
+
+/// Matches inside of macro expansions are rewritten where the token was
+/// spelled, i.e. inside of the #define body or at the macro argument.
+/// Since the same spelling can expand into several different contexts
+/// these edits are deferred until the end of the TU
+void AddSuffixMatcher::addMacroEdit(SourceLocation location,
+                                    StringRef nodeName) {
+    SourceManager &mgr = this->AddSuffixRewriter.getSourceMgr();
+    const SourceLocation spelling = mgr.getSpellingLoc(location);
+
+    // Tokens created through ## and # only exist in the scratch buffer
+    if (mgr.isWrittenInScratchSpace(spelling)) {
+      this->reportMacroConflict(mgr.getExpansionLoc(location), nodeName,
+                                "is formed through token pasting");
+      return;
+    }
+
+    // Other TUs may rewrite the same header concurrently
+    if (this->MainFileEdits && !mgr.isWrittenInMainFile(spelling)) {
+      this->reportMacroConflict(mgr.getExpansionLoc(location), nodeName,
+                                "is spelled outside of the main file");
+      return;
+    }
+
+    this->MacroEdits.insert(std::make_pair(spelling.getRawEncoding(),
+                                           MacroEdit{spelling, nodeName}));
+}
+
+/// Record that a (matched) name inside of a macro expansion should
+/// keep its original name
+void AddSuffixMatcher::addMacroKeep(SourceLocation location) {
+    if (location.isMacroID()) {
+      const SourceLocation spelling = this->AddSuffixRewriter.getSourceMgr()
+                                        .getSpellingLoc(location);
+      this->KeptSpellings.insert(spelling.getRawEncoding());
+    }
+}
+
+void AddSuffixMatcher::reportMacroConflict(SourceLocation location,
+    StringRef nodeName, StringRef reason) {
+    DiagnosticsEngine &diagnostics = this->AddSuffixRewriter.getSourceMgr()
+                                      .getDiagnostics();
+    const unsigned diagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Warning,
+      "cannot add suffix to '%0' inside of macro: the token %1"
+    );
+    diagnostics.Report(location, diagID) << nodeName << reason;
+}
+
+/// Rewrite every macro spelling that was matched, unless the same
+/// spelling also expanded into a name that should not be renamed
+void AddSuffixMatcher::applyMacroEdits() {
+    for (const auto &entry : this->MacroEdits) {
+      const auto &edit = entry.second;
+
+      if (this->KeptSpellings.count(entry.first) > 0) {
+        this->reportMacroConflict(edit.Spelling, edit.Name,
+          "expands to both renamed and non-renamed names");
+        continue;
+      }
+      this->replaceAt(edit.Spelling, edit.Name);
+    }
+    this->MacroEdits.clear();
+}
 
 void AddSuffixMatcher::run(const MatchFinder::MatchResult &result) {
-  this->replaceInDeclMatch(result,    "FunctionDecl");
-  this->replaceInDeclMatch(result,    "VarDecl");
-  this->replaceInDeclRefMatch(result, "DeclRefExpr");
+  Stats::Timer timer(this->Statistics, TIME_RUN);
+
+  this->replaceInDeclMatch(result,    "FunctionDecl", COUNT_FUNCTION_DECL);
+  this->replaceInDeclMatch(result,    "VarDecl",      COUNT_VAR_DECL);
+  this->replaceInDeclRefMatch(result, "DeclRefExpr",  COUNT_DECL_REF_EXPR);
+
+  if (const auto *node = result.Nodes.getNodeAs<NamedDecl>("KeptDecl")) {
+    this->Statistics.count(COUNT_KEPT_DECL);
+    this->addMacroKeep(node->getLocation());
+  }
+  if (const auto *node = result.Nodes.getNodeAs<DeclRefExpr>("KeptRef")) {
+    this->Statistics.count(COUNT_KEPT_REF);
+    this->addMacroKeep(node->getLocation());
+  }
+  if (const auto *node = result.Nodes.getNodeAs<MemberExpr>("KeptMember")) {
+    this->Statistics.count(COUNT_KEPT_MEMBER);
+    this->addMacroKeep(node->getMemberLoc());
+  }
 }
 
 void AddSuffixMatcher::onEndOfTranslationUnit() {
-  // Output to stdout
-  AddSuffixRewriter
-      .getEditBuffer(AddSuffixRewriter.getSourceMgr().getMainFileID())
-      .write(llvm::outs());
+  Stats::Timer timer(this->Statistics, TIME_WRITE);
+  this->applyMacroEdits();
+
+  switch (this->Mode) {
+    case OUTPUT_STDOUT:
+      AddSuffixRewriter
+          .getEditBuffer(AddSuffixRewriter.getSourceMgr().getMainFileID())
+          .write(this->Out);
+      break;
+    case OUTPUT_REPLACEMENTS:
+      this->writeReplacements(this->Out);
+      break;
+    case OUTPUT_IN_PLACE:
+      // Errors are reported through the diagnostics of the SourceManager
+      AddSuffixRewriter.overwriteChangedFiles();
+      break;
+  }
+}
+
+/// Quote a string for YAML (single quotes are escaped by doubling them)
+static void writeYamlString(raw_ostream &out, StringRef str) {
+  out << "'";
+  for (const char c : str) {
+    if (c == '\'') {
+      out << "'";
+    }
+    out << c;
+  }
+  out << "'";
+}
+
+/// Serialize the edits as a TranslationUnitReplacements document, these can
+/// be applied with clang-apply-replacements
+void AddSuffixMatcher::writeReplacements(raw_ostream &out) {
+  const SourceManager &mgr = this->AddSuffixRewriter.getSourceMgr();
+
+  std::sort(this->Edits.begin(), this->Edits.end(),
+    [](const Edit &a, const Edit &b) {
+      return std::tie(a.File, a.Offset) < std::tie(b.File, b.Offset);
+  });
+
+  auto filePath = [&mgr](FileID file) -> StringRef {
+    const FileEntry *entry = mgr.getFileEntryForID(file);
+    if (!entry) {
+      return StringRef();
+    }
+    const StringRef realPath = entry->tryGetRealPathName();
+    return realPath.empty() ? entry->getName() : realPath;
+  };
+
+  out << "---\nMainSourceFile: ";
+  writeYamlString(out, filePath(mgr.getMainFileID()));
+  out << "\nReplacements:";
+
+  if (this->Edits.empty()) {
+    out << " []";
+  }
+  out << "\n";
+
+  for (const auto &edit : this->Edits) {
+    out << "  - FilePath:        ";
+    writeYamlString(out, filePath(edit.File));
+    out << "\n    Offset:          " << edit.Offset
+        << "\n    Length:          " << edit.Length
+        << "\n    ReplacementText: ";
+    writeYamlString(out, edit.Text);
+    out << "\n";
+  }
+  out << "...\n";
 }
 
 //-----------------------------------------------------------------------------
@@ -107,62 +287,234 @@ void AddSuffixMatcher::onEndOfTranslationUnit() {
 // Specifies the node patterns that we want to analyze further in ::run()
 //-----------------------------------------------------------------------------
 
+static const char* CounterNames[] = {
+  "FunctionDecl", "VarDecl", "DeclRefExpr",
+  "KeptDecl", "KeptRef", "KeptMember"
+};
+static const char* TimerNames[] = {
+  "AddSuffix::match", "AddSuffix::run", "AddSuffix::output"
+};
+
 AddSuffixASTConsumer::AddSuffixASTConsumer(
-    Rewriter &R, std::vector<std::string> Names, std::string Suffix)
-    : AddSuffixHandler(R, Suffix), Names(Names), Suffix(Suffix) {
-  // The matcher needs to know the number of arguments
-  // it recieves at compile time so we haft to rely
-  // on a handful of hacky macros to define expressions
-  // were we match agianst 1, 10, 100 or 200 different names
+    Rewriter &R, std::shared_ptr<const NamesFile> Names,
+    const AddSuffixOptions &Options, raw_ostream &Out)
+    : Statistics("AddSuffix", CounterNames, TimerNames),
+      AddSuffixHandler(R, Options, Out, this->Statistics), Names(Names),
+      MainFileOnly(Options.MainFileOnly ||
+                   !Options.AllowedHeaders.empty()),
+      AllowedHeaders(Options.AllowedHeaders), Threads(Options.Threads) {
+  // Match any: 
+  //  - Function declerations
+  //  - Function references (this includes function calls())
+  //  - Variable declerations
+  //  - Variable references
+  //  whose identifier is one of the provided (global) names
   //
-  // We can't (and shouldn't) create to many layers of macros for this
-  //   template instantiation depth exceeds maximum of 900 (use ‘-ftemplate-depth=’ to increase the maximum)
-  // and therefore stop at 200 names
-  int namesLeft = (int)this->Names.size();
-  int batchCnt;
-  
-  while (namesLeft > 0) {
-    // We read the names from LAST to FIRST in the vector
-    // 'namesLeft' is used as the top value for each iteration
-   
-    if ( (batchCnt = namesLeft / 200) >= 1 ) { /* > 199 names left */
-
-      for (int _ = 0; _ < batchCnt; _++) {
-        addMatchers( anyOf(hasNames200(this->Names, namesLeft)) );
-        namesLeft -= 200;
-      }
+  // The set of identifiers is populated in HandleTranslationUnit(), the
+  // number of matchers is therefore constant regardless of how many
+  // names we are given
+  const auto hasNames = hasIdentifierIn(&(this->Identifiers));
 
-    } else if ( (batchCnt = namesLeft / 100) >= 1 ) { /* > 99 names left */
-      
-      for (int _ = 0; _ < batchCnt; _++) {
-        addMatchers( anyOf(hasNames100(this->Names, namesLeft)) );
-        namesLeft -= 100;
-      }
+  const auto matcherForFunctionDecl = functionDecl(hasNames)
+                                        .bind("FunctionDecl");
+
+  const auto matcherForVarDecl = varDecl(hasNames)
+                                        .bind("VarDecl");
+
+  const auto matcherForRefExpr = declRefExpr(to(declaratorDecl(hasNames)))
+                                        .bind("DeclRefExpr");
+
+  // Names that match but that we do not rename, e.g. struct fields and
+  // enum constants. These are only relevant when they are spelled inside
+  // of a macro that is also expanded into a name that we do rename, e.g.
+  //
+  //  #define SIZE(t) (t)->rehash
+  //
+  // where 'rehash' is both a field and a renamed function
+  const auto matcherForKeptDecl = namedDecl(hasNames,
+                                    unless(anyOf(functionDecl(), varDecl())))
+                                        .bind("KeptDecl");
+
+  const auto matcherForKeptRef = declRefExpr(to(namedDecl(hasNames,
+                                    unless(declaratorDecl()))))
+                                        .bind("KeptRef");
+
+  const auto matcherForKeptMember = memberExpr(member(hasNames))
+                                        .bind("KeptMember");
+
+  Finder.addMatcher(matcherForFunctionDecl, &(this->AddSuffixHandler));
+  Finder.addMatcher(matcherForVarDecl,      &(this->AddSuffixHandler));
+  Finder.addMatcher(matcherForRefExpr,      &(this->AddSuffixHandler));
+  Finder.addMatcher(matcherForKeptDecl,     &(this->AddSuffixHandler));
+  Finder.addMatcher(matcherForKeptRef,      &(this->AddSuffixHandler));
+  Finder.addMatcher(matcherForKeptMember,   &(this->AddSuffixHandler));
+}
+
+void AddSuffixASTConsumer::HandleTranslationUnit(ASTContext &Ctx) {
+  // Every identifier seen by the lexer is interned in the IdentifierTable of
+  // the TU, a name without an entry can never occur in the AST
+  // and is skipped
+  this->Identifiers.clear();
+
+  for (const auto &Name : this->Names->names()) {
+    const auto entry = Ctx.Idents.find(Name);
 
-    } else if ( (batchCnt = namesLeft / 10) >= 1 ) { /* > 9 names left */
-      
-      for (int _ = 0; _ < batchCnt; _++) {
-	addMatchers( anyOf(hasNames10(this->Names, namesLeft)) );
-	namesLeft -= 10;
+    if (entry != Ctx.Idents.end()) {
+      this->Identifiers.insert(entry->getValue());
+    }
+  }
+
+  // Patterns can only be resolved by going through every identifier
+  // in the TU
+  if (this->Names->hasPatterns()) {
+    for (const auto &entry : Ctx.Idents) {
+      if (this->Names->matchesPattern(entry.getKey())) {
+        this->Identifiers.insert(entry.getValue());
       }
+    }
+  }
+
+  #if DEBUG_AST
+  llvm::errs() << "\033[33m!>\033[0m Adding suffix onto " <<
+    this->Identifiers.size() << " identifiers (" << 
+    this->Names->names().size() << " names, " << 
+    this->Names->patterns().size() << " patterns)\n";
+  #endif
+
+  {
+    // The output is written from onEndOfTranslationUnit(), i.e. this
+    // includes the time spent in the output stage
+    Stats::Timer timer(this->Statistics, TIME_MATCH);
+
+    if (this->Identifiers.empty()) {
+      // None of the names occur in the TU, the traversal is skipped but the
+      // (unmodified) output is still written
+      this->AddSuffixHandler.onEndOfTranslationUnit();
+    } else if (this->MainFileOnly || this->Threads > 1) {
+      this->setTraversalScope(Ctx);
+      Finder.matchAST(Ctx);
+      Ctx.setTraversalScope({Ctx.getTranslationUnitDecl()});
+    } else {
+      Finder.matchAST(Ctx);
+    }
+  }
+
+  const SourceManager &Mgr = Ctx.getSourceManager();
+  const FileEntry *MainFile = Mgr.getFileEntryForID(Mgr.getMainFileID());
+  this->Statistics.print(MainFile ? MainFile->getName() : StringRef());
+}
+
+// Searches the declarations below a node for one of the identifiers, i.e.
+// for any node that one of the matchers could match. This only reads from
+// the AST
+class IdentifierFinder : public RecursiveASTVisitor<IdentifierFinder> {
+public:
+  explicit IdentifierFinder(const IdentifierSet &Identifiers)
+    : Identifiers(Identifiers) {}
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+  bool shouldVisitImplicitCode() const { return true; }
+
+  // Returning false ends the traversal at the first match
+  bool VisitNamedDecl(NamedDecl *D) { return !this->check(D); }
+  bool VisitDeclRefExpr(DeclRefExpr *E) { return !this->check(E->getDecl()); }
+  bool VisitMemberExpr(MemberExpr *E) {
+    return !this->check(E->getMemberDecl());
+  }
+
+  bool Found = false;
+
+private:
+  bool check(const NamedDecl *D) {
+    const IdentifierInfo *Identifier = D ? D->getIdentifier() : nullptr;
+    if (Identifier != nullptr && this->Identifiers.count(Identifier) > 0) {
+      this->Found = true;
+    }
+    return this->Found;
+  }
+
+  const IdentifierSet &Identifiers;
+};
+
+/// Limit the traversal to the top-level declarations of the main file and
+/// the allowed headers, declarations from other headers are never
+/// descended into. With more than one thread, declarations that do not
+/// contain any of the identifiers are left out as well
+void AddSuffixASTConsumer::setTraversalScope(ASTContext &Ctx) {
+  const SourceManager &Mgr = Ctx.getSourceManager();
+  std::vector<Decl*> Scope;
+
+  for (Decl *D : Ctx.getTranslationUnitDecl()->decls()) {
+    if (!this->MainFileOnly) {
+      Scope.push_back(D);
+      continue;
+    }
+
+    // Declarations created through a macro belong to the file
+    // where the macro was expanded
+    const FileID File = Mgr.getFileID(Mgr.getExpansionLoc(D->getLocation()));
 
-    } else { /* 1-9 names left */
-	#if DEBUG_AST
-	llvm::errs() << "\033[33m!>\033[0m Adding suffix onto " << 
-	  Names[namesLeft - 1 ] << 
-	    " ("<<  namesLeft << " to go)\n";
-	#endif
-        // Note that we will not decrement correctly if 
-	// we do it inside of a macro
-	namesLeft--;
-	addMatchers( hasName(Names[namesLeft]) );
+    if (this->isInScope(Mgr, File)) {
+      Scope.push_back(D);
     }
   }
+
+  if (this->Threads > 1) {
+    Scope = filterDecls(Ctx, Scope, this->Threads, [this](Decl *D){
+      IdentifierFinder Search(this->Identifiers);
+      Search.TraverseDecl(D);
+      return Search.Found;
+    });
+  }
+
+  #if DEBUG_AST
+  llvm::errs() << "\033[33m!>\033[0m Traversing " << Scope.size() << 
+    " top-level declarations\n";
+  #endif
+
+  Ctx.setTraversalScope(Scope);
+}
+
+bool AddSuffixASTConsumer::isInScope(const SourceManager &Mgr, FileID File) {
+  if (File.isInvalid()) {
+    return false;
+  }
+  if (File == Mgr.getMainFileID()) {
+    return true;
+  }
+
+  // Consecutive declarations are usually from the same file
+  if (File == this->LastScopeFile) {
+    return this->LastScopeResult;
+  }
+  this->LastScopeFile = File;
+  this->LastScopeResult = false;
+
+  const FileEntry *Entry = Mgr.getFileEntryForID(File);
+  if (!Entry) {
+    return false;
+  }
+
+  for (const auto &Prefix : this->AllowedHeaders) {
+    if (Entry->getName().startswith(Prefix) ||
+        Entry->tryGetRealPathName().startswith(Prefix)) {
+      this->LastScopeResult = true;
+      break;
+    }
+  }
+  return this->LastScopeResult;
 }
 
 //-----------------------------------------------------------------------------
 // FrontendAction
 //-----------------------------------------------------------------------------
+std::unique_ptr<ASTConsumer> AddSuffixFrontendAction::CreateASTConsumer(
+    CompilerInstance &CI, StringRef file) {
+  RewriterForAddSuffix.setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
+  return std::make_unique<AddSuffixASTConsumer>(
+    RewriterForAddSuffix, this->Names, this->Options, this->Out);
+}
+
 class AddSuffixAddPluginAction : public PluginASTAction {
 public:
   bool ParseArgs(const CompilerInstance &CI,
@@ -176,20 +528,77 @@ public:
     unsigned suffixDiagID = diagnostics.getCustomDiagID(
 	DiagnosticsEngine::Error, "missing -suffix"
     );
+    unsigned readDiagID = diagnostics.getCustomDiagID(
+	DiagnosticsEngine::Error, "failed to read -names-file: %0"
+    );
+    unsigned headerDiagID = diagnostics.getCustomDiagID(
+	DiagnosticsEngine::Error, "missing -allow-header path"
+    );
+    unsigned threadsDiagID = diagnostics.getCustomDiagID(
+	DiagnosticsEngine::Error, "-threads must be a positive integer"
+    );
+    unsigned modeDiagID = diagnostics.getCustomDiagID(
+	DiagnosticsEngine::Error,
+	"-output-mode must be one of: stdout, replacements, in-place"
+    );
 
     for (size_t i = 0, size = args.size(); i != size; ++i) {
 
       if (args[i] == "-names-file") {
           if (parseArg(diagnostics, namesDiagID, size, args, i)){
-                auto NamesFile = args[++i];
-		this->readNamesFromFile(NamesFile);
+                auto Names = std::make_shared<NamesFile>();
+                std::string Error;
+
+                if (!Names->read(args[++i], Error)) {
+                  diagnostics.Report(readDiagID) << Error;
+                  return false;
+                }
+                this->Names = Names;
 	  } else {
                 return false;
 	  }
       }
       else if (args[i] == "-suffix") {
           if (parseArg(diagnostics, suffixDiagID, size, args, i)){
-                this->Suffix = args[++i];
+                this->Options.Suffix = args[++i];
+	  } else {
+                return false;
+	  }
+      }
+      else if (args[i] == "-main-file-only") {
+          this->Options.MainFileOnly = true;
+      }
+      else if (args[i] == "-allow-header") {
+          if (parseArg(diagnostics, headerDiagID, size, args, i)){
+                this->Options.AllowedHeaders.push_back(args[++i]);
+	  } else {
+                return false;
+	  }
+      }
+      else if (args[i] == "-threads") {
+          if (!parseArg(diagnostics, threadsDiagID, size, args, i)){
+                return false;
+          }
+          if (StringRef(args[++i]).getAsInteger(10, this->Options.Threads) ||
+              this->Options.Threads == 0) {
+                diagnostics.Report(threadsDiagID);
+                return false;
+          }
+      }
+      else if (args[i] == "-output-mode") {
+          if (parseArg(diagnostics, modeDiagID, size, args, i)){
+                const auto &mode = args[++i];
+
+                if (mode == "stdout") {
+                  this->Options.Mode = OUTPUT_STDOUT;
+                } else if (mode == "replacements") {
+                  this->Options.Mode = OUTPUT_REPLACEMENTS;
+                } else if (mode == "in-place") {
+                  this->Options.Mode = OUTPUT_IN_PLACE;
+                } else {
+                  diagnostics.Report(modeDiagID);
+                  return false;
+                }
 	  } else {
                 return false;
 	  }
@@ -211,24 +620,10 @@ public:
     RewriterForAddSuffix.setSourceMgr(CI.getSourceManager(),
 				      CI.getLangOpts());
     return std::make_unique<AddSuffixASTConsumer>(
-	RewriterForAddSuffix, this->Names, this->Suffix);
+	RewriterForAddSuffix, this->Names, this->Options);
   }
 
 private:
-  void readNamesFromFile(std::string filename) {
-    std::ifstream file(filename);
-
-    if (file.is_open()) {
-      std::string line;
-
-      while (std::getline(file,line)) {
-	this->Names.push_back(line);
-      }
-
-      file.close();
-    }
-  }
-
   bool parseArg(DiagnosticsEngine &diagnostics, unsigned diagID, int size, 
 		  const std::vector<std::string> &args, int i) {
         
@@ -245,8 +640,8 @@ private:
   }
 
   Rewriter RewriterForAddSuffix;
-  std::vector<std::string> Names;
-  std::string Suffix;
+  std::shared_ptr<const NamesFile> Names = std::make_shared<NamesFile>();
+  AddSuffixOptions Options;
 };
 
 //-----------------------------------------------------------------------------
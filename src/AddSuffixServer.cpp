@@ -0,0 +1,370 @@
+//==============================================================================
+// DESCRIPTION: AddSuffixServer
+//
+// A long running process that keeps the names file loaded and renames files
+// on request. Every request is parsed on a thread pool with the same
+// AddSuffixASTConsumer that is used by the plugin.
+//
+// USAGE:
+//    1. Start the server:
+//      AddSuffixServer --socket /tmp/add-suffix.sock --names-file names.txt '\'
+//        --suffix _old_aaaaaaa --output-mode replacements
+//    2. Send requests:
+//      AddSuffixServer --socket /tmp/add-suffix.sock --client '\'
+//        src/regcomp.c -- -Isrc -I/usr/include
+//
+// PROTOCOL:
+//    The client writes one line per field and then shuts down the
+//    write side of the connection
+//      <working directory>
+//      <file>
+//      <compiler flag>...
+//    The server replies with a status line and the size of the diagnostics
+//    (in bytes), followed by the diagnostics and the output of the run,
+//    i.e. the rewritten file or the replacements. The output is empty on
+//    failure, the diagnostics are sent in either case, e.g. tokens in
+//    macros that were left as they are give a warning
+//      <exit code>
+//      <diagnostics size>
+//      <diagnostics>...<output>...
+//==============================================================================
+#include "AddSuffix.hpp"
+
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace clang;
+using namespace llvm;
+
+static cl::OptionCategory ServerCategory("AddSuffixServer options");
+
+static cl::opt<std::string> SocketPath("socket", cl::Required,
+    cl::desc("Path of the Unix socket to listen on (or connect to)"),
+    cl::cat(ServerCategory));
+
+static cl::opt<bool> Client("client",
+    cl::desc("Send a request to a running server"),
+    cl::cat(ServerCategory));
+
+static cl::list<std::string> ClientArgs(cl::Positional,
+    cl::desc("<file> [-- <compiler flags>...]"),
+    cl::cat(ServerCategory));
+
+static cl::opt<std::string> NamesFilePath("names-file",
+    cl::desc("File with the names to add a suffix to"),
+    cl::cat(ServerCategory));
+
+static cl::opt<std::string> Suffix("suffix",
+    cl::desc("The suffix to add"),
+    cl::cat(ServerCategory));
+
+static cl::opt<OutputMode> Mode("output-mode",
+    cl::desc("What to reply with"),
+    cl::values(
+      clEnumValN(OUTPUT_STDOUT, "stdout", "The rewritten main file"),
+      clEnumValN(OUTPUT_REPLACEMENTS, "replacements",
+                 "The edits in every file as replacements YAML"),
+      clEnumValN(OUTPUT_IN_PLACE, "in-place",
+                 "Overwrite every modified file")),
+    cl::init(OUTPUT_STDOUT),
+    cl::cat(ServerCategory));
+
+static cl::opt<bool> MainFileOnly("main-file-only",
+    cl::desc("Only match inside of the main file"),
+    cl::cat(ServerCategory));
+
+static cl::list<std::string> AllowedHeaders("allow-header",
+    cl::desc("Also match inside of headers with this path prefix"),
+    cl::cat(ServerCategory));
+
+static cl::opt<std::string> ResourceDir("resource-dir",
+    cl::desc("Clang resource directory (for the builtin headers)"),
+    cl::cat(ServerCategory));
+
+static cl::opt<unsigned> Jobs("j",
+    cl::desc("Number of requests to handle concurrently (default: all cores)"),
+    cl::init(0),
+    cl::cat(ServerCategory));
+
+//-----------------------------------------------------------------------------
+// Socket helpers
+//-----------------------------------------------------------------------------
+static bool makeAddress(sockaddr_un &addr) {
+  if (SocketPath.size() >= sizeof(addr.sun_path)) {
+    errs() << "Socket path is too long: " << SocketPath << "\n";
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SocketPath.c_str(), sizeof(addr.sun_path) - 1);
+  return true;
+}
+
+static std::string readAll(int fd) {
+  std::string data;
+  char buf[4096];
+  ssize_t n;
+
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    data.append(buf, n);
+  }
+  return data;
+}
+
+static void writeAll(int fd, StringRef data) {
+  while (!data.empty()) {
+    const ssize_t n = write(fd, data.data(), data.size());
+    if (n <= 0) {
+      return;
+    }
+    data = data.drop_front(n);
+  }
+}
+
+/// Write a reply and close the connection
+static void writeReply(int fd, int status, StringRef diagnostics,
+                       StringRef output = "") {
+  writeAll(fd, std::to_string(status) + "\n" +
+               std::to_string(diagnostics.size()) + "\n");
+  writeAll(fd, diagnostics);
+  writeAll(fd, output);
+  close(fd);
+}
+
+//-----------------------------------------------------------------------------
+// Server
+//-----------------------------------------------------------------------------
+class AddSuffixActionFactory : public tooling::FrontendActionFactory {
+public:
+  AddSuffixActionFactory(std::shared_ptr<const NamesFile> Names,
+      const AddSuffixOptions &Options, raw_ostream &Out)
+      : Names(Names), Options(Options), Out(Out) {}
+
+  std::unique_ptr<FrontendAction> create() override {
+    return std::make_unique<AddSuffixFrontendAction>(Names, Options, Out);
+  }
+
+private:
+  std::shared_ptr<const NamesFile> Names;
+  const AddSuffixOptions &Options;
+  raw_ostream &Out;
+};
+
+// Requests that overwrite files are run one at a time, two TUs that share a
+// header (or a macro spelled in one) would otherwise rewrite it at the
+// same time and read back a partially renamed copy
+static std::mutex InPlaceLock;
+
+/// Run one request and write the reply to the connection
+static void handleRequest(int fd, std::shared_ptr<const NamesFile> Names,
+                          const AddSuffixOptions &Options) {
+  const std::string request = readAll(fd);
+
+  SmallVector<StringRef, 32> fields;
+  StringRef(request).split(fields, '\n', -1, /*KeepEmpty=*/false);
+
+  if (fields.size() < 2) {
+    writeReply(fd, 1, "malformed request\n");
+    return;
+  }
+
+  const std::string directory = fields[0].str();
+
+  // A relative file is relative to the working directory of the client
+  SmallString<256> file(fields[1]);
+  sys::fs::make_absolute(directory, file);
+  std::vector<std::string> flags;
+  for (size_t i = 2; i < fields.size(); i++) {
+    flags.push_back(fields[i].str());
+  }
+
+  std::string output;
+  std::string diagnostics;
+  raw_string_ostream outputStream(output);
+  raw_string_ostream diagnosticsStream(diagnostics);
+
+  tooling::FixedCompilationDatabase db(directory, flags);
+
+  // Each request has its own working directory, the physical file system
+  // (unlike the real one) does not change the working directory of
+  // the process
+  IntrusiveRefCntPtr<vfs::FileSystem> fs(
+    vfs::createPhysicalFileSystem().release());
+  if (auto ec = fs->setCurrentWorkingDirectory(directory)) {
+    writeReply(fd, 1, "failed to enter " + directory + ": " +
+                      ec.message() + "\n");
+    return;
+  }
+  tooling::ClangTool tool(db, {file.str().str()},
+    std::make_shared<PCHContainerOperations>(), fs);
+
+  if (!ResourceDir.empty()) {
+    tool.appendArgumentsAdjuster(tooling::getInsertArgumentAdjuster(
+      ("-resource-dir=" + ResourceDir).c_str(),
+      tooling::ArgumentInsertPosition::END));
+  }
+
+  auto diagOpts = new DiagnosticOptions();
+  TextDiagnosticPrinter diagPrinter(diagnosticsStream, diagOpts);
+  tool.setDiagnosticConsumer(&diagPrinter);
+
+  AddSuffixActionFactory factory(Names, Options, outputStream);
+  std::unique_lock<std::mutex> lock(InPlaceLock, std::defer_lock);
+  if (Options.Mode == OUTPUT_IN_PLACE) {
+    lock.lock();
+  }
+  const int status = tool.run(&factory);
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
+
+  outputStream.flush();
+  diagnosticsStream.flush();
+
+  writeReply(fd, status, diagnostics, status == 0 ? output : "");
+}
+
+static int runServer() {
+  AddSuffixOptions Options;
+  Options.Suffix = Suffix;
+  Options.Mode = Mode;
+  Options.MainFileOnly = MainFileOnly;
+  Options.AllowedHeaders.assign(AllowedHeaders.begin(), AllowedHeaders.end());
+
+  // The names are only loaded once for every request
+  auto Names = std::make_shared<NamesFile>();
+  std::string error;
+  if (!Names->read(NamesFilePath, error)) {
+    errs() << "Failed to read --names-file: " << error << "\n";
+    return 1;
+  }
+
+  sockaddr_un addr;
+  if (!makeAddress(addr)) {
+    return 1;
+  }
+
+  const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(SocketPath.c_str());
+
+  if (server < 0 || bind(server, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(server, SOMAXCONN) != 0) {
+    errs() << "Failed to listen on " << SocketPath << ": "
+           << strerror(errno) << "\n";
+    return 1;
+  }
+
+  // A client that goes away should not bring down the server
+  signal(SIGPIPE, SIG_IGN);
+
+  ThreadPool pool(hardware_concurrency(Jobs));
+
+  errs() << "Listening on " << SocketPath << " (" << pool.getThreadCount()
+         << " threads)\n";
+
+  while (true) {
+    const int fd = accept(server, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      errs() << "accept(): " << strerror(errno) << "\n";
+      break;
+    }
+
+    pool.async([fd, Names, &Options] {
+      handleRequest(fd, Names, Options);
+    });
+  }
+
+  pool.wait();
+  close(server);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Client
+//-----------------------------------------------------------------------------
+static int runClient() {
+  if (ClientArgs.empty()) {
+    errs() << "No file given\n";
+    return 1;
+  }
+
+  sockaddr_un addr;
+  if (!makeAddress(addr)) {
+    return 1;
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    errs() << "Failed to connect to " << SocketPath << ": "
+           << strerror(errno) << "\n";
+    return 1;
+  }
+
+  SmallString<256> cwd;
+  sys::fs::current_path(cwd);
+
+  // The file is sent as an absolute path, the server is not necessarily
+  // running in the same directory
+  SmallString<256> file(ClientArgs[0]);
+  sys::fs::make_absolute(cwd, file);
+
+  std::string request = cwd.str().str() + "\n" + file.str().str() + "\n";
+  for (size_t i = 1; i < ClientArgs.size(); i++) {
+    request += ClientArgs[i] + "\n";
+  }
+  writeAll(fd, request);
+  shutdown(fd, SHUT_WR);
+
+  const std::string reply = readAll(fd);
+  close(fd);
+
+  StringRef status, size, rest;
+  std::tie(status, rest) = StringRef(reply).split('\n');
+  std::tie(size, rest) = rest.split('\n');
+
+  int exitCode = 1;
+  size_t diagnosticsSize = 0;
+  if (status.getAsInteger(10, exitCode) ||
+      size.getAsInteger(10, diagnosticsSize) ||
+      diagnosticsSize > rest.size()) {
+    errs() << "Malformed reply from server\n";
+    return 1;
+  }
+
+  // Warnings are shown even if the request succeeded
+  errs() << rest.take_front(diagnosticsSize);
+  outs() << rest.drop_front(diagnosticsSize);
+  return exitCode;
+}
+
+int main(int argc, const char **argv) {
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+  cl::HideUnrelatedOptions(ServerCategory);
+  cl::ParseCommandLineOptions(argc, argv,
+    "Rename server for the AddSuffix plugin\n");
+
+  return Client ? runClient() : runServer();
+}
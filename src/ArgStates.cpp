@@ -7,41 +7,185 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
 #include "clang/Tooling/CommonOptionsParser.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 
 #include "ArgStates.hpp"
+#include "NamesFile.hpp"
 //-----------------------------------------------------------------------------
 // ArgStatesASTConsumer: Outer wrapper
 //-----------------------------------------------------------------------------
-ArgStatesASTConsumer::ArgStatesASTConsumer(std::string symbolName) {
-  this->symbolName = symbolName;
+static const char* COUNTER_NAMES[] = {
+  "ANY", "REF", "INT", "STR", "CHR", "UNARY", "CACHE_HIT", "CACHE_MISS",
+  "SKIPPED", "SATURATED", "SHARED"
+};
+static const char* TIMER_NAMES[] = {
+  "ArgStates::firstPass", "FirstPass::run", "FirstPass::getParam",
+  "SecondPass::run", "ArgStates::output"
+};
+
+ArgStatesASTConsumer::
+ArgStatesASTConsumer(std::vector<std::string> symbolNames, unsigned threads) :
+ threads(threads), stats("ArgStates", COUNTER_NAMES, TIMER_NAMES) {
+  this->symbolNames = symbolNames;
 }
 
 ArgStatesASTConsumer::~ArgStatesASTConsumer(){
-  this->dumpArgStates();
+  bool written;
+  {
+    Stats::Timer timer(this->stats, TIME_OUTPUT);
+    if (const char *logPath = getenv(OUTPUT_LOG_ENV)) {
+      written = this->appendArgStates(logPath);
+    } else {
+      written = this->dumpArgStates();
+    }
+  }
+
+  // The call sites in headers only count as analyzed once the states
+  // of the TU have been written, a failed TU leaves them to the others
+  if (this->registry && written && !this->hasErrors) {
+    this->registry->commit();
+  }
+  this->stats.print(this->tuPath.empty() ? this->filename : this->tuPath);
 }
 
 void ArgStatesASTConsumer::HandleTranslationUnit(ASTContext &ctx) {
-    auto firstPass = std::make_unique<FirstPassASTConsumer>(this->symbolName);
-    firstPass->HandleTranslationUnit(ctx);
+    this->hasErrors = ctx.getDiagnostics().hasErrorOccurred();
+
+    // The log records hold the full path of the TU, two TUs with the same
+    // basename in different directories are kept apart
+    const auto &srcMgr = ctx.getSourceManager();
+    const auto *mainEntry = srcMgr.getFileEntryForID(srcMgr.getMainFileID());
+    if (mainEntry) {
+      SmallString<256> path(mainEntry->getName());
+      llvm::sys::fs::make_absolute(path);
+      llvm::sys::path::remove_dots(path);
+      this->tuPath = path.str().str();
+
+      // The output files are named after the basename of the TU
+      this->filename = llvm::sys::path::filename(path).str();
+    }
 
-    // The TU name is most easily read from within the match handler
-    this->filename = firstPass->matchHandler.filename;
+    // Every identifier seen by the lexer is interned in the IdentifierTable
+    // of the TU, a symbol without an entry is never called and
+    // is skipped. Note that the names of builtins are always present
+    std::vector<std::string> present;
+    for (const auto &symbolName : this->symbolNames) {
+      if (ctx.Idents.find(symbolName) != ctx.Idents.end()) {
+        present.push_back(symbolName);
+      } else {
+        this->stats.count(COUNT_SKIPPED);
+      }
+    }
 
-    auto secondPass = std::make_unique<SecondPassASTConsumer>(this->symbolName);
+    if (present.empty()) {
+      return;
+    }
 
-    // Copy over the function states
+    if (!this->resultCache) {
+      this->analyze(ctx, present);
+      return;
+    }
+
+    // Only the symbols without an entry in the cache are analyzed
+    const std::string key = this->resultCache->getKey(ctx, this->tuPath);
+    std::vector<std::string> missing;
+
+    for (const auto &symbolName : present) {
+      std::vector<ArgState> states;
+      if (!key.empty() && this->resultCache->load(
+            this->resultCache->entryPath(key, symbolName), symbolName,
+            this->strings, states)) {
+        this->stats.count(COUNT_CACHE_HIT);
+        if (states.size() > 0) {
+          this->argumentStates[symbolName] = std::move(states);
+        }
+      } else {
+        this->stats.count(COUNT_CACHE_MISS);
+        missing.push_back(symbolName);
+      }
+    }
+
+    if (!missing.empty()) {
+      this->analyze(ctx, missing);
+    }
+
+    // TUs with errors are analyzed but never cached
+    if (key.empty() || ctx.getDiagnostics().hasErrorOccurred()) {
+      return;
+    }
+
+    // Symbols without any calls are stored as well, they are the most
+    // common case. The states of a symbol with calls that were analyzed by
+    // another TU are incomplete, they are not stored
+    for (const auto &symbolName : missing) {
+      if (this->registry && this->registry->hasSkipped(symbolName)) {
+        continue;
+      }
+      const auto entry = this->argumentStates.find(symbolName);
+      this->resultCache->store(
+        this->resultCache->entryPath(key, symbolName), symbolName,
+        this->tuPath, entry == this->argumentStates.end() ?
+                      std::vector<ArgState>() : entry->second);
+    }
+}
+
+void ArgStatesASTConsumer::
+analyze(ASTContext &ctx, const std::vector<std::string> &symbolNames) {
+    auto firstPass = std::make_unique<FirstPassASTConsumer>(
+      symbolNames, this->strings, this->stats, this->threads,
+      this->registry.get());
+    {
+      Stats::Timer timer(this->stats, TIME_FIRST_PASS);
+      firstPass->HandleTranslationUnit(ctx);
+    }
+
+    // The second pass only visits the references that the first pass found
+    auto secondPass = std::make_unique<SecondPassASTConsumer>(
+      std::move(firstPass->matchHandler.declRefArgs), this->strings,
+      this->stats);
+
+    // Hand over the function states
     // Note that the first pass only adds literals and the second adds declrefs
     secondPass->matchHandler.argumentStates =
-      firstPass->matchHandler.argumentStates;
-    //secondPass->HandleTranslationUnit(ctx);
+      std::move(firstPass->matchHandler.argumentStates);
+    secondPass->HandleTranslationUnit(ctx);
 
-    // Overwrite the states
-    this->argumentStates = secondPass->matchHandler.argumentStates;
+    // Symbols that were read from the cache are never analyzed,
+    // the states of the analyzed symbols are added to them
+    for (auto &entry : secondPass->matchHandler.argumentStates) {
+      this->argumentStates[entry.first] = std::move(entry.second);
+    }
 }
 
 //-----------------------------------------------------------------------------
 // FrontendAction and Registration
 //-----------------------------------------------------------------------------
+static std::unique_ptr<ASTConsumer> createArgStatesConsumer(
+ CompilerInstance &CI, const std::vector<std::string> &symbolNames,
+ const std::string &cacheDir, unsigned threads,
+ const std::string &registryDir) {
+    auto consumer = std::make_unique<ArgStatesASTConsumer>(symbolNames,
+                                                           threads);
+
+    // The hash of the invocation covers the macros, include paths and
+    // language options that the preprocessor and parser depend on
+    if (!cacheDir.empty()) {
+      consumer->setResultCache(std::make_unique<ResultCache>(
+        cacheDir, CI.getInvocation().getModuleHash()));
+    }
+    if (!registryDir.empty()) {
+      consumer->setCallSiteRegistry(std::make_unique<CallSiteRegistry>(
+        registryDir, CI.getInvocation().getModuleHash()));
+    }
+    return consumer;
+}
+
+std::unique_ptr<ASTConsumer> ArgStatesFrontendAction::CreateASTConsumer(
+    CompilerInstance &CI, StringRef file) {
+  return createArgStatesConsumer(CI, this->symbolNames, this->cacheDir,
+                                 this->threads, this->registryDir);
+}
 
 class ArgStatesAddPluginAction : public PluginASTAction {
 public:
@@ -54,20 +198,120 @@ public:
     uint namesDiagID = diagnostics.getCustomDiagID(
       DiagnosticsEngine::Error, "missing -symbol-name"
     );
+    uint fileDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error, "missing -names-file"
+    );
+    uint readDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error, "failed to read -names-file: %0"
+    );
+    uint patternDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error,
+      "patterns are not supported in the -names-file of ArgStates: '%0'"
+    );
+    uint cacheDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error, "missing -cache-dir"
+    );
+    uint createDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error, "failed to create -cache-dir: %0"
+    );
+    uint registryDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error, "missing -call-site-registry"
+    );
+    uint registryCreateDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error, "failed to create -call-site-registry: %0"
+    );
+    uint runIdDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error,
+      "-call-site-registry requires " RUN_ID_ENV " to be set"
+    );
+    uint threadsDiagID = diagnostics.getCustomDiagID(
+      DiagnosticsEngine::Error, "-threads must be a positive integer"
+    );
 
     for (size_t i = 0, size = args.size(); i != size; ++i) {
       if (args[i] == "-symbol-name") {
          if (parseArg(diagnostics, namesDiagID, size, args, i)){
-             this->symbolName = args[++i];
+             this->symbolNames.push_back(args[++i]);
+         } else {
+             return false;
+         }
+      }
+      else if (args[i] == "-names-file") {
+         if (parseArg(diagnostics, fileDiagID, size, args, i)){
+             NamesFile names;
+             std::string error;
+
+             if (!names.read(args[++i], error)) {
+               diagnostics.Report(readDiagID) << error;
+               return false;
+             }
+             if (names.hasPatterns()) {
+               diagnostics.Report(patternDiagID) << names.patterns()[0];
+               return false;
+             }
+             for (const auto &name : names.names()) {
+               this->symbolNames.push_back(name.str());
+             }
+         } else {
+             return false;
+         }
+      }
+      else if (args[i] == "-cache-dir") {
+         if (parseArg(diagnostics, cacheDiagID, size, args, i)){
+             this->cacheDir = args[++i];
+
+             if (auto ec = llvm::sys::fs::create_directories(this->cacheDir)) {
+               diagnostics.Report(createDiagID) << ec.message();
+               return false;
+             }
          } else {
              return false;
          }
       }
+      else if (args[i] == "-call-site-registry") {
+         if (parseArg(diagnostics, registryDiagID, size, args, i)){
+             // Every run has its own subdirectory, the markers of an
+             // earlier run are never used
+             const char *runId = getenv(RUN_ID_ENV);
+             if (runId == NULL || *runId == '\0' ||
+                 llvm::sys::path::filename(runId) != runId) {
+               diagnostics.Report(runIdDiagID);
+               return false;
+             }
+
+             SmallString<256> path(args[++i]);
+             llvm::sys::path::append(path, runId);
+             this->registryDir = path.str().str();
+
+             if (auto ec = llvm::sys::fs::create_directories(
+                  this->registryDir)) {
+               diagnostics.Report(registryCreateDiagID) << ec.message();
+               return false;
+             }
+         } else {
+             return false;
+         }
+      }
+      else if (args[i] == "-threads") {
+         if (!parseArg(diagnostics, threadsDiagID, size, args, i)){
+             return false;
+         }
+         if (StringRef(args[++i]).getAsInteger(10, this->threads) ||
+             this->threads == 0) {
+             diagnostics.Report(threadsDiagID);
+             return false;
+         }
+      }
       if (!args.empty() && args[0] == "help") {
         llvm::errs() << "No help available";
       }
     }
 
+    if (this->symbolNames.empty()) {
+      diagnostics.Report(namesDiagID);
+      return false;
+    }
+
     return true;
   }
 
@@ -76,7 +320,8 @@ public:
   //  https://clang.llvm.org/docs/RAVFrontendAction.html
   std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
   StringRef file) override {
-    return std::make_unique<ArgStatesASTConsumer>(this->symbolName);
+    return createArgStatesConsumer(CI, this->symbolNames, this->cacheDir,
+                                   this->threads, this->registryDir);
   }
 
 private:
@@ -94,7 +339,10 @@ private:
       return true;
   }
 
-  std::string symbolName;
+  std::vector<std::string> symbolNames;
+  std::string cacheDir;
+  unsigned threads = 1;
+  std::string registryDir;
 };
 
 static FrontendPluginRegistry::Add<ArgStatesAddPluginAction>
@@ -0,0 +1,89 @@
+//==============================================================================
+// DESCRIPTION: ArgStatesCached
+//
+// Runs the ArgStates passes for a set of symbols over every given TU. The AST
+// of each TU is serialized to a cache directory on the first parse and loaded
+// from there on later runs, i.e. a TU is only parsed once regardless of how
+// many symbols are analyzed or how many times the tool is invoked.
+//
+// The output is written to $ARG_STATES_OUT_DIR in the same format as the
+// plugin, one file per symbol and TU, or appended to $ARG_STATES_OUT_LOG
+// if it is set.
+//
+// USAGE:
+//    ARG_STATES_OUT_DIR=.states ArgStatesCached --cache-dir .ast-cache '\'
+//      --symbol-name onig_search,onig_error_code_to_str '\'
+//      -p build src/*.c
+//
+//    Without a compilation database, the compiler flags can be given
+//    after '--' instead of with '-p'
+//==============================================================================
+#include "ASTCache.hpp"
+#include "ArgStates.hpp"
+
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Signals.h"
+
+using namespace clang;
+using namespace llvm;
+
+static cl::OptionCategory CachedCategory("ArgStatesCached options");
+
+static cl::list<std::string> SymbolNames("symbol-name", cl::OneOrMore,
+    cl::CommaSeparated,
+    cl::desc("The function(s) to enumerate argument states for"),
+    cl::cat(CachedCategory));
+
+static cl::opt<std::string> CacheDir("cache-dir", cl::Required,
+    cl::desc("Directory to store serialized ASTs in"),
+    cl::cat(CachedCategory));
+
+static cl::opt<uint64_t> CacheSize("cache-size",
+    cl::desc("Size limit of the cache in MB (default: 4096)"),
+    cl::init(4096),
+    cl::cat(CachedCategory));
+
+int main(int argc, const char **argv) {
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+
+  auto parser = tooling::CommonOptionsParser::create(argc, argv,
+    CachedCategory, cl::OneOrMore);
+  if (!parser) {
+    errs() << toString(parser.takeError());
+    return 1;
+  }
+
+  if (getenv(OUTPUT_DIR_ENV) == NULL && getenv(OUTPUT_LOG_ENV) == NULL) {
+    errs() << "Missing environment variable: " OUTPUT_DIR_ENV
+              " (or " OUTPUT_LOG_ENV ")\n";
+    return 1;
+  }
+
+  if (auto ec = sys::fs::create_directories(CacheDir)) {
+    errs() << "Failed to create " << CacheDir << ": " << ec.message() << "\n";
+    return 1;
+  }
+
+  ASTCache cache(CacheDir, CacheSize * 1024 * 1024);
+  const std::vector<std::string> symbolNames(SymbolNames.begin(),
+                                             SymbolNames.end());
+  int status = 0;
+
+  for (const auto &file : parser->getSourcePathList()) {
+    auto unit = cache.get(parser->getCompilations(), file);
+    if (!unit) {
+      status = 1;
+      continue;
+    }
+
+    // The output for each symbol is written once the consumer is destroyed
+    ArgStatesASTConsumer consumer(symbolNames);
+    consumer.HandleTranslationUnit(unit->getASTContext());
+  }
+
+  PRINT_INFO("AST cache: " << cache.hits << " hit(s), "
+             << cache.misses << " miss(es)");
+  return status;
+}
@@ -0,0 +1,97 @@
+#include "CallSiteRegistry.hpp"
+
+#include "clang/AST/ASTContext.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+using namespace llvm;
+
+bool CallSiteRegistry::claim(ASTContext &ctx, const CallExpr* call,
+ StringRef symbolName) {
+  const SourceManager &srcMgr = ctx.getSourceManager();
+
+  // A call that is spelled in a header but expanded from a macro in the
+  // main file belongs to the main file
+  const auto loc = srcMgr.getDecomposedExpansionLoc(call->getBeginLoc());
+  if (loc.first.isInvalid() || loc.first == srcMgr.getMainFileID()) {
+    return true;
+  }
+
+  const std::string &fileHash = this->getFileHash(srcMgr, loc.first);
+  if (fileHash.empty()) {
+    return true;
+  }
+
+  std::string text;
+  raw_string_ostream os(text);
+  call->printPretty(os, nullptr, ctx.getPrintingPolicy());
+  os.flush();
+
+  MD5 hash;
+  hash.update(fileHash);
+  hash.update(StringRef("\0", 1));
+  hash.update(std::to_string(loc.second));
+  hash.update(StringRef("\0", 1));
+  hash.update(this->invocationHash);
+  hash.update(StringRef("\0", 1));
+  hash.update(text);
+
+  MD5::MD5Result result;
+  hash.final(result);
+
+  SmallString<256> path(this->directory);
+  sys::path::append(path, result.digest().str() + ".site");
+
+  if (sys::fs::exists(path)) {
+    this->skipped.insert(symbolName);
+    return false;
+  }
+
+  this->claimed.push_back(path.str().str());
+  return true;
+}
+
+void CallSiteRegistry::commit() {
+  for (const auto &path : this->claimed) {
+    const int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_CLOEXEC, 0644);
+    if (fd < 0) {
+      // The site is analyzed again by a later TU
+      PRINT_ERR("Failed to create " << path << ": " << strerror(errno));
+      continue;
+    }
+    close(fd);
+  }
+  this->claimed.clear();
+}
+
+/// Returns the (cached) hash of the content of a file, an empty string is
+/// returned if the content is not available
+const std::string& CallSiteRegistry::getFileHash(const SourceManager &srcMgr,
+ FileID file) {
+  auto it = this->fileHashes.find(file);
+  if (it != this->fileHashes.end()) {
+    return it->second;
+  }
+
+  std::string &fileHash = this->fileHashes[file];
+  bool invalid = false;
+  const StringRef content = srcMgr.getBufferData(file, &invalid);
+
+  if (!invalid) {
+    MD5 hash;
+    hash.update(content);
+
+    MD5::MD5Result result;
+    hash.final(result);
+    fileHash = result.digest().str().str();
+  }
+  return fileHash;
+}
@@ -1,88 +1,70 @@
 #include "ArgStates.hpp"
+#include "Shards.hpp"
 #include "Util.hpp"
 
+#include <optional>
+
 // Indexed using the StateType enum to get the
 // corresponding string for each enum
 const char* LITERAL[] = {
   "CHR", "INT", "STR", "UNARY", "NONE"
 };
 
-const std::unordered_map<std::string,StateType> NodeTypes {
-  {"CharacterLiteral", CHR},
-  {"IntegerLiteral", INT},
-  {"StringLiteral", STR},
-  {"UnaryExprOrTypeTraitExpr", UNARY},
-  {"DeclRefExpr", NONE}
-};
-
-void FirstPassMatcher::getCallPath(DynTypedNode &parent,
- std::string bindName, std::vector<DynTypedNode> &callPath){
-    // Go up until we reach a call expression
-    callPath.push_back(parent);
-
-    // The ASTNodeKind returned from this method reflects the strings seen in
-    //  clang -ast-dump
-    if (parent.getNodeKind().asStringRef() == "CallExpr"){
-      // There should be an enum for us to match against but I cannot find it...
-      return;
-    } else {
-      auto parents = this->ctx->getParents(parent);
-      if (parents.size()>0) {
-        // We assume .getParents() only returns one entry
-        auto newParent = parents[0];
-        getCallPath(newParent, bindName, callPath);
-      }
-    }
+/// Returns the StateType of the node types that we can classify,
+/// std::nullopt is returned for every other node type
+static constexpr std::optional<StateType>
+getStateType(Stmt::StmtClass stmtClass) {
+  switch (stmtClass) {
+    case Stmt::CharacterLiteralClass:
+      return CHR;
+    case Stmt::IntegerLiteralClass:
+      return INT;
+    case Stmt::StringLiteralClass:
+      return STR;
+    case Stmt::UnaryExprOrTypeTraitExprClass:
+      return UNARY;
+    case Stmt::DeclRefExprClass:
+      return NONE;
+    default:
+      return std::nullopt;
+  }
 }
 
 /// Returns the parameter index and parameter name given a matched expression
 /// under the matched call (an empty parameter name is
 /// given for unnamed parameters)
-std::tuple<std::string,int> FirstPassMatcher::getParam(
- const CallExpr* matchedCall,
- std::vector<DynTypedNode>& callPath,
- const char* bindName){
-  std::string paramName = "";
-  int  argumentIndex = -1;
-  auto matchedNode = this->nodeMap.at(bindName);
-  auto parents = this->ctx->getParents(matchedNode);
-
-  if (parents.size()>0) {
-    // We assume .getParents() only returns one entry
-    auto parent = parents[0];
-    // Move up recursively until we reach a call expression
-    // (we need to drop implicit casts etc.)
-    // Since we save all of the nodes in the path we traverse
-    // upwards, we can check which of the arguments our path corresponds to
-    getCallPath(parent, bindName, callPath);
-
-    // We use .push_back() so the last item will be the actual call,
-    // we are interested in the direct child from the call that is on the
-    // path towards our match, which will be at the penultimate position,
-    // if the callPath only contains one item, then our matched node is
-    // a direct child of the callexpr
-    auto ourPath = callPath.size() > 1 ?
-      callPath[callPath.size()-2] :
-      matchedNode;
-
-    auto ourExpr = ourPath.get<Expr>();
+///
+/// The argument (or callee) subtree that the matched expression is located
+/// under is tagged by the visitor while descending, i.e. we never
+/// need to traverse the AST upwards
+std::tuple<StringRef,int> FirstPassMatcher::getParam(
+ const CallExpr* matchedCall){
+  Stats::Timer timer(this->stats, TIME_GET_PARAM);
+  StringRef paramName = "";
+  int  argumentIndex = matchedCall->getNumArgs();
+
+  // The expression is not necessarily located directly under the matched
+  // call, it could also be nested inside a call to a different function,
+  // in which case it does not correspond to any of the arguments
+  // of the matched call and the index will be NumArgs
+  if (this->position.call == matchedCall) {
+    const auto ourExpr = this->position.arg;
 
     argumentIndex = 0;
     for (auto call_arg : matchedCall->arguments()){
-      // Break once we find an argument in the matched call expression
-      // that matches the node we found traversing the AST upwards from
-      // our match
-      if (call_arg->getID(*ctx) == ourExpr->getID(*ctx) ) {
+      // Break once we find the argument in the matched call expression
+      // that our match is located under
+      if (call_arg == ourExpr) {
         break;
       }
       argumentIndex++;
     }
 
-    if ( ourExpr->getID(*ctx) == matchedCall->getCallee()->getID(*ctx) ){
+    if (ourExpr == matchedCall->getCallee()){
       // Check if our expression actually corresponds to the
       // functionDecl node at index '-1'
       // The paramName will be the function name in this case
-      paramName = std::string(matchedCall->getDirectCallee()->getName());
+      paramName = matchedCall->getDirectCallee()->getName();
       argumentIndex = -1;
     }
     else if (argumentIndex < int(matchedCall->getNumArgs()) ){
@@ -108,7 +90,7 @@ std::tuple<std::string,int> FirstPassMatcher::getParam(
 
         // Some declarations omit naming their parameters, e.g.
         // void foo(int, char*), the name will be empty in these scenarios
-        paramName             = std::string(paramDecl->getName());
+        paramName             = paramDecl->getName();
       }
     }
   }
@@ -116,35 +98,34 @@ std::tuple<std::string,int> FirstPassMatcher::getParam(
   return std::tuple(paramName,argumentIndex);
 }
 
-void FirstPassMatcher::handleLiteralMatch(variants value,
-StateType matchedType, const CallExpr* call, const Expr* matchedExpr){
+template<typename T>
+void FirstPassMatcher::handleLiteralMatch(T value,
+StateType matchedType, const CallExpr* call, const FunctionDecl* fnc,
+const Expr* matchedExpr){
+  auto &argumentStates = this->getStates(fnc);
+
   // Determine which parameter this argument corresponds to
-  auto callPath = std::vector<DynTypedNode>();
-  const auto param = this->getParam(call, callPath, LITERAL[matchedType]);
-  const std::string paramName  = std::get<0>(param);
+  const auto param = this->getParam(call);
+  const StringRef paramName    = std::get<0>(param);
   const int paramIndex         = std::get<1>(param);
 
   // An argState entry should already exist from the
   // ANY-matching stage for each param
-  assert(this->argumentStates[paramIndex].type == matchedType);
-
-  // The callPath always contains at least one element: <match> [ callexpr ]
-  assert(callPath.size() >= 1);
+  assert(argumentStates[paramIndex].type == matchedType);
 
-  const auto argState         = this->argumentStates[paramIndex];
-  const auto firtstParentKind = callPath[0].getNodeKind().asStringRef();
+  const auto &argState        = argumentStates[paramIndex];
 
   bool matchIsDet = false;
 
   if (argState.isNonDet){
     // Already identified as nondet()
   }
-  else if (callPath.size() == 1 && firtstParentKind == "CallExpr") {
-    // If the callPath only contains 1 element we have an exact call, e.g.
+  else if (this->position.arg == matchedExpr) {
+    // If the literal is a direct child of the call we have an exact call, e.g.
     //  foo(int x) -> foo(1)
     matchIsDet = true;
   }
-  else if (callPath.size() >= 2){
+  else {
     // If we have #define statements akin to
     //  #define XML_FALSE ((XML_Bool)0)
     //  We get:
@@ -157,55 +138,159 @@ StateType matchedType, const CallExpr* call, const Expr* matchedExpr){
     // then check if the simplified top argument
     // corresponds to the integral type that we matched to handle these cases
     //
-    // If the callPath only contains 2 elements:
-    //  <match>: [ implicitCast, callExpr ]
+    // If the literal is only wrapped in an implicit cast:
+    //  callExpr -> implicitCast -> <match>
     // Then we have a 'clean' value besides an implicit cast, e.g.
     //  foo(MY_INT x) -> foo(1)
     //  This case is also covered by this check
-    const auto topArg = callPath[callPath.size()-2].get<Expr>();
-    const auto simplifiedTopArg = topArg->IgnoreParenNoopCasts(*ctx) \
-                                  ->IgnoreImplicit()->IgnoreCasts();
-    const auto type = simplifiedTopArg->getStmtClassName();
-    if (NodeTypes.count(type) > 0 &&  NodeTypes.at(type) == matchedType){
+    const auto topArg = cast<Expr>(this->position.arg);
+    const auto simplifiedTopArg = util::ignoreCasts(topArg, ctx);
+    if (getStateType(simplifiedTopArg->getStmtClass()) == matchedType){
         matchIsDet = true;
     }
   }
 
   if (matchIsDet){
-    this->argumentStates[paramIndex].states.insert(value);
+    argumentStates[paramIndex].addState(value);
 
     // We remove the ids for every match that corresponds to a det() case
     // At the final write-to-disk stage, the params with an empty ids[] set
     // are those that can be considered det()
     // Exactly one element should be erased with this operation
-    assert(
-      this->argumentStates[paramIndex].ids.erase(matchedExpr->getID(*ctx))
-      == 1
-    );
+    const auto erased =
+      argumentStates[paramIndex].ids.erase(matchedExpr->getID(*ctx));
+    assert(erased == 1);
+    (void)erased;
 
     PRINT_INFO(LITERAL[matchedType] << "> " << paramName << " (det): "
         << matchedExpr->getID(*ctx) << " ("
-        << this->argumentStates[paramIndex].ids.size() << ")" );
+        << argumentStates[paramIndex].ids.size() << ")" );
   } else {
     // Unmatched base case: nondet()
-    this->argumentStates[paramIndex].isNonDet = true;
+    argumentStates[paramIndex].isNonDet = true;
     PRINT_INFO(LITERAL[matchedType] << "> " << paramName << " (nondet): "
         << matchedExpr->getID(*ctx) << " ("
-        << this->argumentStates[paramIndex].ids.size() << ")" );
+        << argumentStates[paramIndex].ids.size() << ")" );
   }
 }
 
 //-----------------------------------------------------------------------------
 // FirstPassASTConsumer- implementation
+// FirstPassVisitor-     implementation
 // FirstPassMatcher-     implementation
 //-----------------------------------------------------------------------------
 
 void FirstPassASTConsumer::HandleTranslationUnit(ASTContext &ctx) {
-  this->finder.matchAST(ctx);
+  FirstPassVisitor visitor(ctx, this->matchHandler, this->symbolNames,
+                           this->stats, this->registry);
+
+  if (this->threads > 1) {
+    // The visitor only walks the top-level declarations that contain a
+    // call to one of the symbols, the matches are handled in the same
+    // order as in a full traversal
+    const auto tu = ctx.getTranslationUnitDecl();
+    const std::vector<Decl*> decls(tu->decls_begin(), tu->decls_end());
+
+    ctx.setTraversalScope(filterDecls(ctx, decls, this->threads,
+      [this](Decl* decl){
+        TargetCallFinder finder(this->symbolNames);
+        finder.TraverseDecl(decl);
+        return finder.found;
+    }));
+    visitor.TraverseAST(ctx);
+    ctx.setTraversalScope({tu});
+  } else {
+    visitor.TraverseAST(ctx);
+  }
+
+  this->matchHandler.dumpUnhandledLeaves();
 }
 
 FirstPassASTConsumer::
-FirstPassASTConsumer(std::string symbolName): matchHandler() {
+FirstPassASTConsumer(const std::vector<std::string> &symbolNames,
+ llvm::UniqueStringSaver &strings, Stats &stats, unsigned threads,
+ CallSiteRegistry* registry):
+ matchHandler(strings, stats), stats(stats), threads(threads),
+ registry(registry) {
+  for (const auto &name : symbolNames) {
+    this->symbolNames.insert(name);
+  }
+}
+
+/// Returns the called function if it is one of the symbols
+static const FunctionDecl* getTarget(const CallExpr* call,
+ const llvm::StringSet<> &symbolNames) {
+  const auto fnc = dyn_cast_or_null<FunctionDecl>(call->getCalleeDecl());
+  if (fnc == nullptr || fnc->getIdentifier() == nullptr ||
+      symbolNames.count(fnc->getName()) == 0) {
+    return nullptr;
+  }
+  return fnc;
+}
+
+bool TargetCallFinder::VisitCallExpr(CallExpr* call) {
+  // Returning false ends the traversal at the first call
+  this->found = getTarget(call, this->symbolNames) != nullptr;
+  return !this->found;
+}
+
+bool FirstPassVisitor::TraverseDecl(Decl* decl) {
+  const auto parent       = this->parent;
+  const auto parentDecl   = this->parentDecl;
+  const auto functionBody = this->functionBody;
+  const auto caller       = this->caller;
+
+  this->parent      = nullptr;
+  this->parentDecl  = decl;
+  if (const auto function = dyn_cast_or_null<FunctionDecl>(decl)) {
+    this->caller = function;
+  }
+  const bool result = RecursiveASTVisitor::TraverseDecl(decl);
+
+  this->parent       = parent;
+  this->parentDecl   = parentDecl;
+  this->functionBody = functionBody;
+  this->caller       = caller;
+  return result;
+}
+
+// Overriding TraverseStmt() disables the data recursion of the
+// RecursiveASTVisitor, every node is visited before its children
+// (in pre-order), which is the same order as that of the MatchFinder
+bool FirstPassVisitor::TraverseStmt(Stmt* stmt, DataRecursionQueue* queue) {
+  if (stmt == nullptr) {
+    return true;
+  }
+  // Nothing in the rest of the TU can change the states once every symbol
+  // is saturated, returning false aborts the traversal
+  if (this->matchHandler.saturatedCount() == this->symbolNames.size()) {
+    return false;
+  }
+  const auto call     = this->call;
+  const auto fnc      = this->fnc;
+  const auto skipCall = this->skipCall;
+  const auto parent   = this->parent;
+  const auto position = this->position;
+
+  // Tag the subtree of each argument of a call while descending, we only
+  // consider plain calls (not e.g. CXXMemberCallExpr) as the call boundary
+  if (this->parent != nullptr &&
+      this->parent->getStmtClass() == Stmt::CallExprClass) {
+    this->position.call = cast<CallExpr>(this->parent);
+    this->position.arg  = stmt;
+  }
+
+  if (this->parent == nullptr && isa<CompoundStmt>(stmt) &&
+      isa_and_nonnull<FunctionDecl>(this->parentDecl)) {
+    this->functionBody = stmt;
+  }
+
+  // Every expression below a call is handled, including nested calls
+  if (this->call != nullptr && !this->skipCall && isa<Expr>(stmt)) {
+    this->matchHandler.run(this->ctx, this->call, this->fnc,
+                           cast<Expr>(stmt), this->position, this->caller);
+  }
+
   // The first child of a call expression is a declRefExpr to the
   // function being invoked
   //
@@ -229,241 +314,122 @@ FirstPassASTConsumer(std::string symbolName): matchHandler() {
   //        CALL_EXPR
   //
   // Testcase: XML_SetBase in xmlwf/xmlfile.c
-  const auto isArgumentOfCall = hasAncestor(
-      callExpr(callee(
-          functionDecl(hasName(symbolName)
-          ).bind("FNC")
-          ),
-      unless(hasParent(compoundStmt(hasParent(functionDecl()))))
-  ).bind("CALL"));
-
-  // Note that we exclude DeclRefExpr nodes which have a MemberExpr as an
-  // ancestor, e.g. arguments on the form 'dtd->pool'. These expressions
-  // are matched separately as MemberExpr to retrieve '->pool' rather than 'dtd'
-  const auto declRefMatcher = declRefExpr(to(
-    declaratorDecl()),
-    unless(hasAncestor(memberExpr())),
-    isArgumentOfCall
-  ).bind("REF");
-
-  // We need the literals to be direct descendants
-  // (barring the implicitCastExpr) otherwise they could be part of
-  // larger expressions, e.g. 'foo + 6'
-  // For now, any literal that is not a direct descendent of the call will be
-  // considered an undet() value
-  const auto intMatcher     =
-    integerLiteral(isArgumentOfCall).bind(LITERAL[INT]);
-  const auto stringMatcher  =
-    stringLiteral(isArgumentOfCall).bind(LITERAL[STR]);
-  const auto charMatcher    =
-    characterLiteral(isArgumentOfCall).bind(LITERAL[CHR]);
-
-  // Calls to 'sizeof()' and 'alignof()', which are both compile time constants,
-  // are matched with this node type
-  const auto unaryExprMatcher   = unaryExprOrTypeTraitExpr(isArgumentOfCall)
-                                                          .bind(LITERAL[UNARY]);
-
-  // Note, for a sound solution we cannot exclude any calls (except those that
-  // do not use the return value). We must therefore have a liberal matcher
-  // that matches any argument formation for each parameter, if this matcher
-  // is ever filled with something that we cannot handle (i.e. not a literal)
-  // then the parameter is nondet().
-  const auto anyMatcher     = expr(isArgumentOfCall).bind("ANY");
-
-  // Matchers are executed in the _order that they are added to the finder_
-  // This does not infer that the anyMatcher will go through ALL nodes before
-  // any matches are handled by the other matchers, but it does mean that
-  // any node visited by the other matchers will always first have been
-  // visited by the anyMatcher.
   //
-  // With this in mind we can always assume that an argState entry exists
-  // for a literal match since the anyMatcher will have created
-  // one during its visit
-  this->finder.addMatcher(anyMatcher,     &(this->matchHandler));
-
-  this->finder.addMatcher(declRefMatcher, &(this->matchHandler));
-  this->finder.addMatcher(intMatcher,     &(this->matchHandler));
-  this->finder.addMatcher(stringMatcher,  &(this->matchHandler));
-  this->finder.addMatcher(charMatcher,    &(this->matchHandler));
-  this->finder.addMatcher(unaryExprMatcher,    &(this->matchHandler));
-}
+  // All symbols are handled in the same traversal, note that an argument
+  // which is nested inside a call to another one of the symbols is
+  // attributed to the innermost call
+  //
+  // A call in a header that another TU has already analyzed remains the
+  // innermost call for its arguments, but nothing below it is handled
+  if (const auto callStmt = dyn_cast<CallExpr>(stmt)) {
+    const bool isStatement = this->parent != nullptr &&
+                             this->parent == this->functionBody;
+    const auto target = isStatement ? nullptr :
+                         getTarget(callStmt, this->symbolNames);
+    if (target != nullptr) {
+      this->call = callStmt;
+      this->fnc  = target;
+      this->skipCall = this->registry != nullptr &&
+        !this->registry->claim(this->ctx, callStmt, target->getName());
+      if (this->skipCall) {
+        this->stats.count(COUNT_SHARED);
+      }
+    }
+  }
 
+  this->parent = stmt;
+  const bool result = RecursiveASTVisitor::TraverseStmt(stmt, queue);
+
+  this->call     = call;
+  this->fnc      = fnc;
+  this->skipCall = skipCall;
+  this->parent   = parent;
+  this->position = position;
+  return result;
+}
 
 void FirstPassMatcher::
-run(const MatchFinder::MatchResult &result) {
+run(ASTContext &ctx, const CallExpr* call, const FunctionDecl* fnc,
+ const Expr* expr, const CallPosition &position,
+ const FunctionDecl* caller) {
   // The idea:
   // Determine what types of arguments are passed to the function
   // For literal and NULL arguments, we add their value to the state space
   //
-  // For declrefs, we save the names of each argument and query for
-  // all references to them before the call (in the same enclosing function)
-  // in the next pass (not implemented)
+  // For declrefs, we save the reference and determine which definitions
+  // of the variable reach the call (in the same enclosing function)
+  // in the next pass
   // The key cases we want to detect are
   //   1. When literals are passed
   //   2. When an uninitialized (null) variable is passed
   //   3. When a variable is assigned a literal value (and remains unchanged)
   // We skip considering struct fields (MemberExpr) for now
+  Stats::Timer timer(this->stats, TIME_FIRST_RUN);
 
   // Holds information on the actual source code
-  this->srcMgr = result.SourceManager;
-
-  // Holds contextual information about the AST, this allows
-  // us to determine e.g. the parents of a matched node
-  this->ctx = result.Context;
-  this->nodeMap = result.Nodes.getMap();
-
-  // ::run() is invoked anew for every match, the getNodes() calls
-  // that get populated depend on the binds() defined for each matcher
-  // i.e. all of the matches will have CALL available since the
-  // 'isArgumentOfCall' is included in every matcher
-  const auto *call       = result.Nodes.getNodeAs<CallExpr>("CALL");
-  const auto *fnc        = result.Nodes.getNodeAs<FunctionDecl>("FNC");
-  assert(call && fnc);
-
-  const auto *declRef    = result.Nodes.getNodeAs<DeclRefExpr>("REF");
-  const auto *anyArg     = result.Nodes.getNodeAs<Expr>("ANY");
-
-  const auto *intLiteral = result.Nodes.getNodeAs<IntegerLiteral>(LITERAL[INT]);
-  const auto *strLiteral = result.Nodes.getNodeAs<StringLiteral>(LITERAL[STR]);
-  const auto *chrLiteral =
-    result.Nodes.getNodeAs<CharacterLiteral>(LITERAL[CHR]);
-  const auto *unaryExpr  =
-    result.Nodes.getNodeAs<UnaryExprOrTypeTraitExpr>(LITERAL[UNARY]);
+  this->srcMgr = &ctx.getSourceManager();
+
+  // Holds contextual information about the AST
+  this->ctx = &ctx;
+
+  // The argument subtree of the innermost call that the expression
+  // is located under
+  this->position = position;
+  this->caller   = caller;
 
   // To correlate the arguments that we match against to parameters in the
   // function call we need to traverse the call expression and pair the
   // arguments with the Parms from the FNC
 
-  // Extract the filename (basename) of the current TU so that
-  // the outer consumer knows what filename to use for the output file
-  auto filepath = srcMgr->getFilename(call->getEndLoc());
-  this->filename = filepath.substr(filepath.find_last_of("/\\") + 1);
-
-
-  /***** First matching stage ****/
-  // Creates a set of all node IDs that need to be inspected for
-  // each argument
-  if (anyArg) {
-    const auto name = anyArg->getStmtClassName();
-    util::dumpMatch("ANY", name, 1, this->srcMgr, anyArg->getEndLoc());
-
-    // Determine which parameter the leaf node corresponds to
-    auto callPath = std::vector<DynTypedNode>();
-    const auto param = this->getParam(call, callPath, "ANY");
-    const std::string paramName  = std::get<0>(param);
-    const int paramIndex         = std::get<1>(param);
-
-    // Skip matches which correspond to the called function name
-    // ('-1'th node of every call)
-    if (paramName == fnc->getName()){
-      return;
-    }
-
-    if (paramName.size()==0 && paramIndex == -1){
-      PRINT_ERR("ANY> Failed to determine param for: ");
-      anyArg->dumpColor();
-    } else {
-      auto leafStmt = util::getFirstLeaf(anyArg, ctx);
-
-      // If the array contains fewer elements than the paramIndex
-      // insert dummy elements starting from the first uninitialized position
-      // We cannot simply insert a parameter at the current last position
-      // since there is no guarantee that we encounter the function
-      // arguments in order, i.e. the first match could be the fifth argument
-      while ((int)this->argumentStates.size() <= paramIndex) {
-        struct ArgState argState = {
-          .ids = std::set<uint64_t>(),
-          .states = std::set<variants>(),
-        };
-
-        // Set the paramName once we reach the correct index
-        if ((int)this->argumentStates.size()==paramIndex){
-          argState.paramName = paramName;
-        }
-
-        this->argumentStates.push_back(argState);
-      }
-
-
-      // Set the argument type
-      const auto className = leafStmt->getStmtClassName();
-      if (NodeTypes.find(className) != NodeTypes.end()){
-        this->argumentStates[paramIndex].type = NodeTypes.at(className);
-      } else {
-        PRINT_ERR("ANY> Unhandled leaf node type: " << className);
-      }
-
-      // Save the nodeID of the leaf stmt for this match
-      uint64_t stmtID = leafStmt->getID(*ctx);
-      this->argumentStates[paramIndex].ids.insert(stmtID);
-
-      PRINT_INFO("ANY> " << paramName << " "<< className << ": "
-          << leafStmt->getID(*ctx) \
-          << " (" << this->argumentStates[paramIndex].ids.size() << ")" );
-    }
+  // Expressions below a nested call, e.g. the '1' in foo(bar(1)), are not
+  // under any argument of the matched call. The parameter is already
+  // nondet() from the nested call itself, these would only add an unnamed
+  // entry after the last parameter
+  if (this->position.call != call) {
+    return;
   }
-  /***** Second matching stage ****/
-  else if (declRef) {
-    // This includes a match for the actual function token (index -1)
-    const auto name = declRef->getDecl()->getName();
-    util::dumpMatch("REF", name, 1, this->srcMgr, declRef->getEndLoc());
-
-    // During the second pass we must be able to identify
-    //  * the enclosing function
-    //  * the callee
-    //  * the argument name
-    //  for every reference that we encounter in the 1st pass
-
-    auto callPath = std::vector<DynTypedNode>();
-    auto param    = this->getParam(call, callPath, "REF");
-    const std::string paramName  = std::get<0>(param);
-    const int paramIndex         = std::get<1>(param);
-
-    if (paramName == fnc->getName()){
-      return;
-    }
 
-    // Set all declrefs as nondet()
-    while ((int)this->argumentStates.size() <= paramIndex) {
-      struct ArgState argState = {
-        .ids = std::set<uint64_t>(),
-        .states = std::set<variants>(),
-      };
-
-      // Set specific values once we reach the correct index
-      if ((int)this->argumentStates.size()==paramIndex){
-        argState.paramName = paramName;
-        argState.isNonDet = true;
-      }
+  // Once every parameter of the symbol is nondet(), none of the remaining
+  // matches can change its states
+  if (this->saturated.count(fnc->getName()) > 0) {
+    return;
+  }
 
-      this->argumentStates.push_back(argState);
-    }
+  // Every expression is first handled as an 'ANY' match and afterwards
+  // as a literal match (if it is a literal). With this in mind we can always
+  // assume that an argState entry exists when a literal is handled
+  this->handleAnyMatch(call, fnc, expr);
 
-  }
-  else if (intLiteral) {
+  if (const auto intLiteral = dyn_cast<IntegerLiteral>(expr)) {
     const auto value =  intLiteral->getValue().getLimitedValue();
+    this->stats.count(COUNT_INT);
     util::dumpMatch(LITERAL[INT], value, 1, this->srcMgr,
         intLiteral->getLocation());
-    this->handleLiteralMatch(value, INT, call, intLiteral);
+    this->handleLiteralMatch(value, INT, call, fnc, intLiteral);
   }
-  else if (strLiteral) {
-    const auto value =  std::string(strLiteral->getString());
+  else if (const auto strLiteral = dyn_cast<StringLiteral>(expr)) {
+    // The value is interned in the string pool of the TU, every
+    // occurrence of the same literal shares one copy
+    const auto value =  this->strings.save(strLiteral->getString());
+    this->stats.count(COUNT_STR);
     util::dumpMatch(LITERAL[STR], value, 1, this->srcMgr,
         strLiteral->getEndLoc());
-    this->handleLiteralMatch(value, STR, call, strLiteral);
+    this->handleLiteralMatch(value, STR, call, fnc, strLiteral);
   }
-  else if (chrLiteral) {
+  else if (const auto chrLiteral = dyn_cast<CharacterLiteral>(expr)) {
     const auto value =  chrLiteral->getValue();
+    this->stats.count(COUNT_CHR);
     util::dumpMatch(LITERAL[CHR], value, 1, this->srcMgr,
         chrLiteral->getLocation());
-    this->handleLiteralMatch(value, CHR, call, chrLiteral);
+    this->handleLiteralMatch(value, CHR, call, fnc, chrLiteral);
   }
-  else if (unaryExpr) {
+  else if (const auto unaryExpr = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
     // Matches alignof() and sizeof(), instead of inserting these values
     // as text we evaluate them as integer values
     //  https://clang.llvm.org/doxygen/classclang_1_1UnaryExprOrTypeTraitExpr.html#details
     Expr::EvalResult res;
-    unaryExpr->EvaluateAsInt(res, *ctx);
+    this->stats.count(COUNT_UNARY);
+    unaryExpr->EvaluateAsInt(res, *this->ctx);
     if (res.HasSideEffects || res.HasUndefinedBehavior) {
       util::dumpMatch(LITERAL[UNARY], "FAILED to evaluate", 1, this->srcMgr,
           unaryExpr->getEndLoc());
@@ -471,8 +437,147 @@ run(const MatchFinder::MatchResult &result) {
       const auto value = res.Val.getInt().getLimitedValue();
       util::dumpMatch(LITERAL[UNARY], value, 1, this->srcMgr,
           unaryExpr->getEndLoc());
-      this->handleLiteralMatch(value, UNARY, call, unaryExpr);
+      this->handleLiteralMatch(value, UNARY, call, fnc, unaryExpr);
+    }
+  }
+
+  this->checkSaturated(fnc);
+}
+
+/// Mark the symbol as saturated if every one of its parameters is nondet().
+/// Only prototyped, non-variadic C functions are considered, every call
+/// to these has exactly one argument per parameter and expressions that are
+/// not under an argument are dropped by run(), i.e. no new parameter
+/// entries can be added by a later call
+void FirstPassMatcher::checkSaturated(const FunctionDecl* fnc) {
+  if (this->ctx->getLangOpts().CPlusPlus || fnc->isVariadic() ||
+      !fnc->getType()->isFunctionProtoType()) {
+    return;
+  }
+
+  const auto &argumentStates = this->getStates(fnc);
+  if (argumentStates.size() != fnc->getNumParams()) {
+    return;
+  }
+  for (const auto &argState : argumentStates) {
+    if (!argState.isNonDet) {
+      return;
+    }
+  }
+
+  this->saturated.insert(fnc->getName());
+  this->stats.count(COUNT_SATURATED);
+  PRINT_INFO("ANY> " << fnc->getName() << ": every parameter is nondet");
+}
+
+/// Returns the argument states of the given symbol
+std::vector<ArgState>& FirstPassMatcher::getStates(const FunctionDecl* fnc) {
+  // Heterogeneous lookup, a std::string is only created for the first call
+  // to each symbol
+  const auto it = this->argumentStates.find(fnc->getName());
+  if (it != this->argumentStates.end()) {
+    return it->second;
+  }
+  return this->argumentStates[fnc->getName().str()];
+}
+
+/// Print how many argument leaves of each unhandled node type were seen
+void FirstPassMatcher::dumpUnhandledLeaves() {
+  for (uint i = 0; i <= Stmt::lastStmtConstant; i++) {
+    if (this->unhandledLeaves[i] > 0) {
+      PRINT_INFO("ANY> Unhandled leaf node type: " << this->unhandledNames[i]
+                 << " (" << this->unhandledLeaves[i] << ")");
     }
   }
 }
 
+/// Creates a set of all node IDs that need to be inspected for
+/// each argument.
+/// Note that DeclRefExpr arguments need no special handling, the id of the
+/// reference remains in the ids[] set of the parameter, i.e. the parameter
+/// will be considered nondet()
+void FirstPassMatcher::handleAnyMatch(const CallExpr* call,
+ const FunctionDecl* fnc, const Expr* anyArg) {
+  // The states of each symbol are kept apart
+  auto &argumentStates = this->getStates(fnc);
+
+  const auto name = anyArg->getStmtClassName();
+  this->stats.count(COUNT_ANY);
+  util::dumpMatch("ANY", name, 1, this->srcMgr, anyArg->getEndLoc());
+
+  // Determine which parameter the leaf node corresponds to
+  const auto param = this->getParam(call);
+  const StringRef paramName    = std::get<0>(param);
+  const int paramIndex         = std::get<1>(param);
+
+  // Skip matches which correspond to the called function name
+  // ('-1'th node of every call)
+  if (paramName == fnc->getName()){
+    return;
+  }
+
+  if (paramName.size()==0 && paramIndex == -1){
+    PRINT_ERR("ANY> Failed to determine param for: ");
+    anyArg->dumpColor();
+  } else {
+    auto leafStmt = util::getFirstLeaf(anyArg, ctx);
+
+    // If the array contains fewer elements than the paramIndex
+    // insert dummy elements starting from the first uninitialized position
+    // We cannot simply insert a parameter at the current last position
+    // since there is no guarantee that we encounter the function
+    // arguments in order, i.e. the first match could be the fifth argument
+    while ((int)argumentStates.size() <= paramIndex) {
+      struct ArgState argState;
+
+      // Set the paramName once we reach the correct index
+      if ((int)argumentStates.size()==paramIndex){
+        argState.paramName = this->strings.save(paramName);
+      }
+
+      argumentStates.push_back(argState);
+    }
+
+
+    // Set the argument type
+    const auto stmtClass = leafStmt->getStmtClass();
+    if (const auto stateType = getStateType(stmtClass)) {
+      argumentStates[paramIndex].type = *stateType;
+    } else {
+      // Summarized once the traversal is done
+      this->unhandledLeaves[stmtClass]++;
+      if (this->unhandledLeaves[stmtClass] == 1) {
+        this->unhandledNames[stmtClass] = leafStmt->getStmtClassName();
+      }
+    }
+
+    // Save the nodeID of the leaf stmt for this match
+    uint64_t stmtID = leafStmt->getID(*ctx);
+    argumentStates[paramIndex].ids.insert(stmtID);
+
+    // An argument that is only a reference to a variable, e.g. foo(x) or
+    // foo((int)x), is handed to the second pass which removes the id if
+    // every definition of the variable that reaches the call is a literal
+    const bool isRefArg = isa<DeclRefExpr>(leafStmt) &&
+        this->caller != nullptr && this->position.call == call &&
+        util::ignoreCasts(cast<Expr>(this->position.arg), ctx) == leafStmt;
+
+    if (leafStmt == anyArg && isRefArg) {
+      this->declRefArgs.push_back({this->caller, fnc, call,
+                                   cast<DeclRefExpr>(anyArg), paramIndex});
+    }
+
+    // The id of a leaf is only ever removed by the literal match of the
+    // leaf itself or by the second pass, the parameter is nondet()
+    // right away if neither applies
+    const auto leafType = getStateType(stmtClass);
+    if (!isRefArg && (!leafType || *leafType == NONE)) {
+      argumentStates[paramIndex].isNonDet = true;
+    }
+
+    PRINT_INFO("ANY> " << paramName << " "
+        << leafStmt->getStmtClassName() << ": "
+        << leafStmt->getID(*ctx) \
+        << " (" << argumentStates[paramIndex].ids.size() << ")" );
+  }
+}
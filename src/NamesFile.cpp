@@ -0,0 +1,120 @@
+#include "NamesFile.hpp"
+
+#include "llvm/ADT/DenseSet.h"
+
+using namespace llvm;
+
+bool NamesFile::read(StringRef filename, std::string &error) {
+  // Files larger than a few pages are mmap():ed, we do not need a null
+  // terminator since the buffer is split on newlines explicitly
+  auto file = MemoryBuffer::getFile(filename, /*IsText=*/false,
+                                    /*RequiresNullTerminator=*/false);
+  if (!file) {
+    error = filename.str() + ": " + file.getError().message();
+    return false;
+  }
+  this->buffer = std::move(*file);
+
+  DenseSet<StringRef> seen;
+  StringRef rest = this->buffer->getBuffer();
+
+  while (!rest.empty()) {
+    StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+
+    // Strips trailing '\r' as well
+    line = line.trim();
+    if (line.empty() || !seen.insert(line).second) {
+      continue;
+    }
+
+    if (isPattern(line)) {
+      this->globs.push_back(line);
+      this->globPrefixes.push_back(line.take_until([](char c){
+        return c == '*' || c == '?' || c == '[';
+      }));
+    } else {
+      this->exactNames.push_back(line);
+    }
+  }
+
+  if (this->hasPatterns()) {
+    std::string regex = "^(";
+    for (size_t i = 0; i < this->globs.size(); i++) {
+      if (i > 0) {
+        regex += "|";
+      }
+      globToRegex(this->globs[i], regex);
+    }
+    regex += ")$";
+
+    this->patternRegex = std::make_unique<Regex>(regex);
+    if (!this->patternRegex->isValid(error)) {
+      error = filename.str() + ": invalid pattern: " + error;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool NamesFile::matchesPattern(StringRef name) const {
+  if (!this->patternRegex) {
+    return false;
+  }
+
+  // Running the regex is comparatively expensive, most identifiers
+  // in a TU can be discarded based on the literal prefix of each pattern
+  for (const auto &prefix : this->globPrefixes) {
+    if (name.startswith(prefix)) {
+      return this->patternRegex->match(name);
+    }
+  }
+  return false;
+}
+
+bool NamesFile::isPattern(StringRef entry) {
+  return entry.find_first_of("*?[") != StringRef::npos;
+}
+
+/// Append the POSIX ERE equivalent of a glob to 'regex'
+void NamesFile::globToRegex(StringRef glob, std::string &regex) {
+  bool inBracket = false;
+
+  for (size_t i = 0; i < glob.size(); i++) {
+    const char c = glob[i];
+
+    if (inBracket) {
+      if (c == ']') {
+        inBracket = false;
+      }
+      regex += c;
+      continue;
+    }
+
+    switch (c) {
+      case '*':
+        regex += ".*";
+        break;
+      case '?':
+        regex += ".";
+        break;
+      case '[':
+        inBracket = true;
+        regex += c;
+        // [!abc] is the glob form of [^abc]
+        if (i + 1 < glob.size() && glob[i+1] == '!') {
+          regex += '^';
+          i++;
+        }
+        break;
+      case '.': case '^': case '$': case '|': case '(': case ')':
+      case '+': case '{': case '}': case '\\': case ']':
+        regex += '\\';
+        regex += c;
+        break;
+      default:
+        regex += c;
+    }
+  }
+}
@@ -0,0 +1,419 @@
+//==============================================================================
+// DESCRIPTION: PluginDriver
+//
+// Runs the ArgStates or AddSuffix action over the TUs of a compilation
+// database in one process, every TU is parsed on a thread pool instead of
+// spawning one 'clang -cc1' per file.
+//
+//  - The resource directory (which holds the builtin headers, e.g.
+//    stddef.h) is resolved once and passed to every TU, the clang driver
+//    derives the -internal-isystem paths from it
+//  - Compile commands that only differ in their output (-o, -MF, ...)
+//    are only run once
+//  - TUs are started largest first, a large TU that is started last
+//    would otherwise keep one thread busy after all others are done
+//  - With --dedupe-header-calls, ArgStates uses a CallSiteRegistry in a
+//    temporary directory that is created (and removed) for every run
+//
+// If no files are given, every file in the compilation database is run.
+//
+// USAGE:
+//    ARG_STATES_OUT_LOG=states.ndjson PluginDriver --plugin ArgStates '\'
+//      --symbol-name onig_search,onig_error_code_to_str -p build
+//
+//    PluginDriver --plugin AddSuffix --names-file names.txt '\'
+//      --suffix _old_aaaaaaa --output-mode in-place -p build src/regcomp.c
+//==============================================================================
+#include "AddSuffix.hpp"
+#include "ArgStates.hpp"
+
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace clang;
+using namespace llvm;
+
+enum PluginKind {
+  PLUGIN_ARG_STATES,
+  PLUGIN_ADD_SUFFIX
+};
+
+static cl::OptionCategory DriverCategory("PluginDriver options");
+
+static cl::opt<PluginKind> Plugin("plugin", cl::Required,
+    cl::desc("The action to run on every TU"),
+    cl::values(
+      clEnumValN(PLUGIN_ARG_STATES, "ArgStates",
+                 "Enumerate the argument states of the given symbols"),
+      clEnumValN(PLUGIN_ADD_SUFFIX, "AddSuffix",
+                 "Add a suffix to the given names")),
+    cl::cat(DriverCategory));
+
+static cl::list<std::string> SymbolNames("symbol-name", cl::CommaSeparated,
+    cl::desc("ArgStates: the function(s) to enumerate argument states for"),
+    cl::cat(DriverCategory));
+
+static cl::opt<std::string> NamesFilePath("names-file",
+    cl::desc("File with the symbols (ArgStates) or names (AddSuffix)"),
+    cl::cat(DriverCategory));
+
+static cl::opt<std::string> CacheDir("cache-dir",
+    cl::desc("ArgStates: directory to cache the results of each TU in"),
+    cl::cat(DriverCategory));
+
+static cl::opt<bool> DedupeHeaderCalls("dedupe-header-calls",
+    cl::desc("ArgStates: only analyze each call in a header in one TU"),
+    cl::cat(DriverCategory));
+
+static cl::opt<std::string> Suffix("suffix",
+    cl::desc("AddSuffix: the suffix to add"),
+    cl::cat(DriverCategory));
+
+static cl::opt<OutputMode> Mode("output-mode",
+    cl::desc("AddSuffix: what to output"),
+    cl::values(
+      clEnumValN(OUTPUT_STDOUT, "stdout", "The rewritten main file"),
+      clEnumValN(OUTPUT_REPLACEMENTS, "replacements",
+                 "The edits in every file as replacements YAML"),
+      clEnumValN(OUTPUT_IN_PLACE, "in-place",
+                 "Overwrite every modified file")),
+    cl::init(OUTPUT_REPLACEMENTS),
+    cl::cat(DriverCategory));
+
+static cl::opt<bool> MainFileOnly("main-file-only",
+    cl::desc("AddSuffix: only match inside of the main file"),
+    cl::cat(DriverCategory));
+
+static cl::list<std::string> AllowedHeaders("allow-header",
+    cl::desc("AddSuffix: also match inside of headers with this path prefix"),
+    cl::cat(DriverCategory));
+
+static cl::opt<std::string> ResourceDir("resource-dir",
+    cl::desc("Clang resource directory (for the builtin headers)"),
+    cl::cat(DriverCategory));
+
+static cl::opt<unsigned> Jobs("j",
+    cl::desc("Number of TUs to run concurrently (default: all cores)"),
+    cl::init(0),
+    cl::cat(DriverCategory));
+
+static cl::opt<unsigned> TUThreads("tu-threads",
+    cl::desc("Number of threads to search each TU with (default: 1)"),
+    cl::init(1),
+    cl::cat(DriverCategory));
+
+//-----------------------------------------------------------------------------
+// Compile commands
+//-----------------------------------------------------------------------------
+struct Job {
+  tooling::CompileCommand command;
+  // The size of the main file, used as an estimate of the cost of the TU
+  uint64_t size;
+};
+
+// Hands one compile command to a ClangTool
+class SingleCommandDatabase : public tooling::CompilationDatabase {
+public:
+  explicit SingleCommandDatabase(const tooling::CompileCommand &command)
+    : command(command) {}
+
+  std::vector<tooling::CompileCommand>
+    getCompileCommands(StringRef file) const override {
+    return {this->command};
+  }
+
+private:
+  tooling::CompileCommand command;
+};
+
+/// The directory given with --resource-dir, the resource directory of the
+/// clang installation that the driver was built against, or the one next
+/// to the driver itself (in that order)
+static std::string getResourceDir(const char *argv0) {
+  std::vector<std::string> candidates;
+  if (!ResourceDir.empty()) {
+    candidates.push_back(ResourceDir);
+  }
+#ifdef CLANG_RESOURCE_DIR
+  candidates.push_back(CLANG_RESOURCE_DIR);
+#endif
+  static int staticSymbol;
+  candidates.push_back(
+    CompilerInvocation::GetResourcesPath(argv0, (void*)&staticSymbol));
+
+  for (const auto &dir : candidates) {
+    SmallString<256> include(dir);
+    sys::path::append(include, "include", "stddef.h");
+    if (sys::fs::exists(include)) {
+      return dir;
+    }
+  }
+  return std::string();
+}
+
+/// Collect the compile commands of every file, commands that are identical
+/// apart from their output files are only added once. The jobs are sorted
+/// with the largest main file first
+static std::vector<Job> getJobs(const tooling::CompilationDatabase &db,
+ const std::vector<std::string> &files) {
+  const auto strip = tooling::combineAdjusters(
+    tooling::getClangStripOutputAdjuster(),
+    tooling::getClangStripDependencyFileAdjuster());
+
+  std::vector<Job> jobs;
+  StringSet<> seen;
+  unsigned duplicates = 0;
+
+  for (const auto &file : files) {
+    for (auto &command : db.getCompileCommands(file)) {
+      command.CommandLine = strip(command.CommandLine, command.Filename);
+
+      std::string key = command.Directory;
+      for (const auto &arg : command.CommandLine) {
+        key += '\0';
+        key += arg;
+      }
+      if (!seen.insert(key).second) {
+        duplicates++;
+        continue;
+      }
+
+      SmallString<256> path(command.Filename);
+      sys::fs::make_absolute(command.Directory, path);
+      uint64_t size = 0;
+      sys::fs::file_size(path, size);
+
+      jobs.push_back({std::move(command), size});
+    }
+  }
+
+  std::stable_sort(jobs.begin(), jobs.end(),
+    [](const Job &a, const Job &b){ return a.size > b.size; });
+
+  PRINT_INFO(jobs.size() << " TU(s), " << duplicates <<
+             " duplicate command(s) skipped");
+  return jobs;
+}
+
+//-----------------------------------------------------------------------------
+// Actions
+//-----------------------------------------------------------------------------
+class ArgStatesActionFactory : public tooling::FrontendActionFactory {
+public:
+  ArgStatesActionFactory(const std::vector<std::string> &symbolNames,
+      const std::string &registryDir)
+      : symbolNames(symbolNames), registryDir(registryDir) {}
+
+  std::unique_ptr<FrontendAction> create() override {
+    return std::make_unique<ArgStatesFrontendAction>(symbolNames, CacheDir,
+                                                     TUThreads, registryDir);
+  }
+
+private:
+  const std::vector<std::string> &symbolNames;
+  const std::string &registryDir;
+};
+
+class AddSuffixActionFactory : public tooling::FrontendActionFactory {
+public:
+  AddSuffixActionFactory(std::shared_ptr<const NamesFile> Names,
+      const AddSuffixOptions &Options, raw_ostream &Out)
+      : Names(Names), Options(Options), Out(Out) {}
+
+  std::unique_ptr<FrontendAction> create() override {
+    return std::make_unique<AddSuffixFrontendAction>(Names, Options, Out);
+  }
+
+private:
+  std::shared_ptr<const NamesFile> Names;
+  const AddSuffixOptions &Options;
+  raw_ostream &Out;
+};
+
+/// Run one compile command with the given action, returns the exit
+/// status of ClangTool::run()
+static int runJob(const Job &job, tooling::FrontendActionFactory &factory,
+ const std::string &resourceDir) {
+  SingleCommandDatabase db(job.command);
+
+  // Each TU has its own working directory, the physical file system
+  // (unlike the real one) does not change the working directory of
+  // the process
+  IntrusiveRefCntPtr<vfs::FileSystem> fs(
+    vfs::createPhysicalFileSystem().release());
+  tooling::ClangTool tool(db, {job.command.Filename},
+    std::make_shared<PCHContainerOperations>(), fs);
+
+  if (!resourceDir.empty()) {
+    tool.appendArgumentsAdjuster(tooling::getInsertArgumentAdjuster(
+      ("-resource-dir=" + resourceDir).c_str(),
+      tooling::ArgumentInsertPosition::END));
+  }
+  return tool.run(&factory);
+}
+
+int main(int argc, const char **argv) {
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+
+  auto parser = tooling::CommonOptionsParser::create(argc, argv,
+    DriverCategory, cl::ZeroOrMore);
+  if (!parser) {
+    errs() << toString(parser.takeError());
+    return 1;
+  }
+
+  const auto &db = parser->getCompilations();
+  std::vector<std::string> files = parser->getSourcePathList();
+  if (files.empty()) {
+    files = db.getAllFiles();
+  }
+
+  const std::string resourceDir = getResourceDir(argv[0]);
+  if (resourceDir.empty()) {
+    errs() << "Could not find the clang resource directory, "
+              "use --resource-dir\n";
+    return 1;
+  }
+  PRINT_INFO("Using resource directory: " << resourceDir);
+
+  // Both plugins read the names in the same way
+  auto Names = std::make_shared<NamesFile>();
+  if (!NamesFilePath.empty()) {
+    std::string error;
+    if (!Names->read(NamesFilePath, error)) {
+      errs() << "Failed to read --names-file: " << error << "\n";
+      return 1;
+    }
+  }
+
+  std::vector<std::string> symbolNames(SymbolNames.begin(),
+                                       SymbolNames.end());
+  AddSuffixOptions Options;
+  unsigned threads = Jobs;
+  std::string registryDir;
+
+  // The output of AddSuffix is collected for each TU and written at once,
+  // the output of concurrent TUs is never interleaved
+  std::mutex outputLock;
+
+  switch (Plugin) {
+    case PLUGIN_ARG_STATES:
+      if (Names->hasPatterns()) {
+        errs() << "Patterns are not supported by ArgStates: '"
+               << Names->patterns()[0] << "'\n";
+        return 1;
+      }
+      for (const auto &name : Names->names()) {
+        symbolNames.push_back(name.str());
+      }
+      if (symbolNames.empty()) {
+        errs() << "Missing --symbol-name or --names-file\n";
+        return 1;
+      }
+      if (getenv(OUTPUT_DIR_ENV) == NULL && getenv(OUTPUT_LOG_ENV) == NULL) {
+        errs() << "Missing environment variable: " OUTPUT_DIR_ENV
+                  " (or " OUTPUT_LOG_ENV ")\n";
+        return 1;
+      }
+      if (!CacheDir.empty()) {
+        if (auto ec = sys::fs::create_directories(CacheDir)) {
+          errs() << "Failed to create " << CacheDir << ": "
+                 << ec.message() << "\n";
+          return 1;
+        }
+      }
+      if (DedupeHeaderCalls) {
+        SmallString<256> prefix, path;
+        sys::path::system_temp_directory(true, prefix);
+        sys::path::append(prefix, "arg-states-call-sites");
+
+        if (auto ec = sys::fs::createUniqueDirectory(prefix, path)) {
+          errs() << "Failed to create the call site registry: "
+                 << ec.message() << "\n";
+          return 1;
+        }
+        registryDir = path.str().str();
+        PRINT_INFO("Using call site registry: " << registryDir);
+      }
+      break;
+    case PLUGIN_ADD_SUFFIX:
+      if (NamesFilePath.empty() || Suffix.empty()) {
+        errs() << "Missing --names-file or --suffix\n";
+        return 1;
+      }
+      Options.Suffix = Suffix;
+      Options.Mode = Mode;
+      Options.MainFileOnly = MainFileOnly;
+      Options.AllowedHeaders.assign(AllowedHeaders.begin(),
+                                    AllowedHeaders.end());
+      Options.Threads = TUThreads;
+
+      // Headers are shared between TUs, two TUs must never rewrite
+      // the same header at the same time. Only the main file is modified
+      // when there are no allowed headers (macros defined in headers
+      // are left as they are)
+      if (Mode == OUTPUT_IN_PLACE &&
+          !(MainFileOnly && AllowedHeaders.empty())) {
+        threads = 1;
+      }
+      break;
+  }
+
+  const std::vector<Job> jobs = getJobs(db, files);
+  std::atomic<int> status(0);
+
+  ThreadPool pool(hardware_concurrency(threads));
+
+  // The pool has one queue that every thread takes the next TU from,
+  // i.e. the TUs are started in the order of the jobs
+  for (const auto &job : jobs) {
+    pool.async([&] {
+      int result;
+
+      if (Plugin == PLUGIN_ARG_STATES) {
+        ArgStatesActionFactory argStates(symbolNames, registryDir);
+        result = runJob(job, argStates, resourceDir);
+      } else {
+        std::string output;
+        raw_string_ostream out(output);
+        AddSuffixActionFactory addSuffix(Names, Options, out);
+        result = runJob(job, addSuffix, resourceDir);
+        out.flush();
+
+        std::lock_guard<std::mutex> lock(outputLock);
+        outs() << output;
+        outs().flush();
+      }
+
+      if (result != 0) {
+        status = 1;
+      }
+    });
+  }
+
+  pool.wait();
+
+  // The registry is only valid for one run
+  if (!registryDir.empty()) {
+    sys::fs::remove_directories(registryDir);
+  }
+  return status;
+}
@@ -0,0 +1,173 @@
+#include "ResultCache.hpp"
+#include "ArgStates.hpp"
+
+#include "clang/Basic/Version.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace llvm;
+
+// Bumped whenever the analysis or the format of the entries changes,
+// entries written by an older plugin are never read
+#define RESULT_CACHE_VERSION "1"
+
+std::string ResultCache::getKey(ASTContext &ctx, StringRef tuPath) {
+  SourceManager &srcMgr = ctx.getSourceManager();
+
+  // The files are visited in a fixed order, the order of the FileInfos
+  // map depends on the addresses of the entries
+  std::vector<const FileEntry*> files;
+  for (auto it = srcMgr.fileinfo_begin(); it != srcMgr.fileinfo_end(); ++it) {
+    files.push_back(it->first);
+  }
+  std::sort(files.begin(), files.end(),
+    [](const FileEntry *a, const FileEntry *b){
+      return a->getName() < b->getName();
+  });
+
+  MD5 hash;
+  hash.update(RESULT_CACHE_VERSION);
+  hash.update(StringRef("\0", 1));
+  hash.update(getClangFullVersion());
+  hash.update(StringRef("\0", 1));
+  hash.update(this->invocationHash);
+  hash.update(StringRef("\0", 1));
+  // __FILE__ expands to a different string for every path
+  hash.update(tuPath);
+
+  for (const auto *file : files) {
+    // The buffers are already loaded, this does not read the file again
+    auto buffer = srcMgr.getMemoryBufferForFileOrNone(file);
+    if (!buffer) {
+      return std::string();
+    }
+    hash.update(StringRef("\0", 1));
+    hash.update(file->getName());
+    hash.update(StringRef("\0", 1));
+    hash.update(buffer->getBuffer());
+  }
+
+  MD5::MD5Result result;
+  hash.final(result);
+  return result.digest().str().str();
+}
+
+std::string ResultCache::entryPath(StringRef key, StringRef symbolName) {
+  MD5 hash;
+  hash.update(key);
+  hash.update(StringRef("\0", 1));
+  hash.update(symbolName);
+
+  MD5::MD5Result result;
+  hash.final(result);
+
+  SmallString<256> path(this->directory);
+  sys::path::append(path, result.digest().str() + ".json");
+  return std::string(path.str());
+}
+
+bool ResultCache::load(const std::string &path, StringRef symbolName,
+ UniqueStringSaver &strings, std::vector<ArgState> &argumentStates) {
+  auto buffer = MemoryBuffer::getFile(path);
+  if (!buffer) {
+    return false;
+  }
+
+  auto value = json::parse((*buffer)->getBuffer());
+  if (!value) {
+    consumeError(value.takeError());
+    return false;
+  }
+
+  // The entry has the same format as a record of the log, see writeRecord()
+  const json::Object *record = value->getAsObject();
+  if (!record || record->getString("symbol") != symbolName) {
+    return false;
+  }
+  const json::Array *params = record->getArray("params");
+  if (!params) {
+    return false;
+  }
+
+  std::vector<ArgState> states(params->size());
+
+  for (size_t i = 0; i < params->size(); i++) {
+    const json::Object *param = (*params)[i].getAsObject();
+    if (!param) {
+      return false;
+    }
+    const auto name = param->getString("name");
+    const auto nondet = param->getBoolean("nondet");
+    const json::Array *values = param->getArray("states");
+    if (!name || !nondet || !values) {
+      return false;
+    }
+
+    ArgState &argState = states[i];
+    argState.paramName = strings.save(*name);
+
+    if (*nondet) {
+      argState.isNonDet = true;
+      continue;
+    }
+
+    for (const auto &item : *values) {
+      if (const auto str = item.getAsString()) {
+        argState.type = STR;
+        argState.addState(strings.save(*str));
+      } else if (const auto num = item.getAsInteger()) {
+        argState.type = INT;
+        argState.addState(static_cast<uint64_t>(*num));
+      } else {
+        return false;
+      }
+    }
+  }
+
+  argumentStates = std::move(states);
+  return true;
+}
+
+void ResultCache::store(const std::string &path, StringRef symbolName,
+ StringRef tuPath, const std::vector<ArgState> &argumentStates) {
+  // json::parse() does not read integers above INT64_MAX back correctly,
+  // results with such a state are not cached (the states are sorted and
+  // the states of nondet() params are never written)
+  for (const auto &argState : argumentStates) {
+    if (!argState.isNonDet && argState.ids.empty() &&
+        !argState.intStates.empty() &&
+        argState.intStates.end()[-1] > uint64_t(INT64_MAX)) {
+      return;
+    }
+  }
+
+  int fd;
+  SmallString<256> tmpPath;
+  if (auto ec = sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd,
+                                          tmpPath)) {
+    PRINT_ERR("Failed to create " << path << ": " << ec.message());
+    return;
+  }
+
+  raw_fd_ostream os(fd, /*shouldClose=*/true);
+  writeRecord(os, symbolName.str(), tuPath, argumentStates);
+  os.close();
+
+  std::error_code ec = os.error();
+  os.clear_error();
+
+  if (!ec) {
+    ec = sys::fs::rename(tmpPath, path);
+  }
+  if (ec) {
+    PRINT_ERR("Failed to write " << path << ": " << ec.message());
+    sys::fs::remove(tmpPath);
+  }
+}
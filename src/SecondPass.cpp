@@ -4,65 +4,348 @@
 //-----------------------------------------------------------------------------
 // SecondPassASTConsumer- implementation
 // SecondPassMatcher-     implementation
-// (Unfinished)
 //-----------------------------------------------------------------------------
 void SecondPassASTConsumer::HandleTranslationUnit(ASTContext &ctx) {
-  this->finder.matchAST(ctx);
+  // In C++ a variable can be modified without taking its address, e.g.
+  // through a reference parameter, a by-reference lambda capture or a
+  // range-for reference, the arguments are left as nondet()
+  if (ctx.getLangOpts().CPlusPlus) {
+    PRINT_INFO("REF> Skipping the second pass for C++");
+    return;
+  }
+  for (const auto &arg : this->declRefArgs) {
+    this->matchHandler.run(ctx, arg);
+  }
 }
 
 SecondPassASTConsumer::
-SecondPassASTConsumer(std::string symbolName) : matchHandler() {
-  // PRINT_WARN("Second pass!");
-
-  const auto isArgumentOfCall = hasAncestor(
-      callExpr(callee(
-          functionDecl(hasName(symbolName))
-            .bind("FNC")
-          ),
-      unless(hasParent(compoundStmt(hasParent(functionDecl()))))
-  ).bind("CALL"));
-
-  // Note that we exclude DeclRefExpr nodes which have a MemberExpr as an
-  // ancenstor, e.g. arguments on the form 'dtd->pool'. These experssions
-  // are matched seperatly as MemberExpr to retrieve '->pool' rather than 'dtd'
-  const auto declRefMatcher = declRefExpr(to(
-    declaratorDecl()), 
-    unless(hasAncestor(memberExpr())),
-    isArgumentOfCall
-  ).bind("REF");
-
-
-  this->finder.addMatcher(declRefMatcher, &(this->matchHandler));
+SecondPassASTConsumer(std::vector<DeclRefArg> declRefArgs,
+ llvm::UniqueStringSaver &strings, Stats &stats) :
+ matchHandler(strings, stats), declRefArgs(std::move(declRefArgs)) {}
+
+/// Returns the variable that an expression refers to (if any)
+static const VarDecl* getVar(const Expr* expr) {
+  if (const auto declRef = dyn_cast<DeclRefExpr>(expr->IgnoreParens())) {
+    return dyn_cast<VarDecl>(declRef->getDecl());
+  }
+  return nullptr;
 }
 
-void SecondPassMatcher::
-run(const MatchFinder::MatchResult &result) {
-    // In the second pass we will match agianst every plain declRef
-    // that was encountered as an argument during the first pass
-    //
-    // We can only derive state information if we find ALL references
-    // to the the variable, and all are simple assignments
-    // or simple statements where we know its value is unchanged.
-    //
-    // Any reference to the variable which we cannot conclusivly
-    // say gives it a new value or does NOT give it a new value
-    // need to be treated as potential state changes...
-
-
-    // Holds information on the actual source code
-    this->srcMgr = result.SourceManager;
-
-    // Holds contxtual information about the AST, this allows
-    // us to determine e.g. the parents of a matched node
-    this->ctx = result.Context;
-    this->nodeMap = result.Nodes.getMap();
-
-    //const auto *call       = result.Nodes.getNodeAs<CallExpr>("CALL");
-    const auto *declRef    = result.Nodes.getNodeAs<DeclRefExpr>("REF");
-
-    if (declRef) {
-      const auto name = declRef->getDecl()->getName();
-      util::dumpMatch("REF", name, 2, srcMgr, declRef->getEndLoc());
+void SecondPassMatcher::run(ASTContext &ctx, const DeclRefArg &arg) {
+    // We can only derive state information if we find ALL definitions
+    // of the variable that reach the call, and all of them assign
+    // a literal value. Any reference to the variable which could change
+    // its value in a way that we cannot follow (e.g. through a pointer)
+    // needs to be treated as a potential state change
+    Stats::Timer timer(this->stats, TIME_SECOND_RUN);
+    this->stats.count(COUNT_REF);
+
+    // Holds contextual information about the AST
+    this->ctx = &ctx;
+
+    const auto name = arg.declRef->getDecl()->getName();
+    util::dumpMatch("REF", name, 2, &ctx.getSourceManager(),
+                    arg.declRef->getEndLoc());
+
+    const auto it = this->argumentStates.find(arg.fnc->getName());
+    if (it == this->argumentStates.end() ||
+        arg.paramIndex >= (int)it->second.size()) {
+      return;
+    }
+    auto &argState = it->second[arg.paramIndex];
+
+    // Nothing can be gained for a parameter that is already nondet(),
+    // the CFG is never built in this case
+    if (argState.isNonDet) {
+      return;
+    }
+
+    // Globals and static locals can be modified outside of the function,
+    // as can __block variables (by a block). Only the value of scalars
+    // (integers and pointers) is followed
+    const auto var = dyn_cast<VarDecl>(arg.declRef->getDecl());
+    if (var == nullptr || !var->hasLocalStorage() ||
+        var->getType().isVolatileQualified() || var->hasAttr<BlocksAttr>() ||
+        !var->getType()->isScalarType()) {
+      return;
     }
+
+    const auto function = this->getCFG(arg.caller);
+    if (function == nullptr || function->escaped.count(var) > 0) {
+      return;
+    }
+
+    ReachingDefs defs;
+    if (!this->getReachingDefs(*function, var, arg, defs) ||
+        !this->addStates(argState, defs)) {
+      PRINT_INFO("REF> " << name << " (nondet): "
+          << arg.declRef->getID(ctx) << " (" << argState.ids.size() << ")");
+      return;
+    }
+
+    // Every definition was a literal, the reference is now det()
+    argState.ids.erase(arg.declRef->getID(ctx));
+    PRINT_INFO("REF> " << name << " (det): "
+        << arg.declRef->getID(ctx) << " (" << argState.ids.size() << ")");
+}
+
+/// Returns the CFG of the function, it is built on the first call
+/// for each function. A nullptr is returned if no CFG can be built
+SecondPassMatcher::FunctionCFG*
+SecondPassMatcher::getCFG(const FunctionDecl* caller) {
+  const auto it = this->cfgs.find(caller);
+  if (it != this->cfgs.end()) {
+    return it->second.get();
+  }
+
+  auto function = std::make_unique<FunctionCFG>();
+
+  // Every (sub)expression is added as an element of its own, i.e.
+  // the position of each reference in the CFG is known
+  CFG::BuildOptions options;
+  options.setAllAlwaysAdd();
+
+  if (caller->hasBody()) {
+    function->cfg = CFG::buildCFG(caller, caller->getBody(), this->ctx,
+                                  options);
+  }
+  if (!function->cfg) {
+    this->cfgs[caller] = nullptr;
+    return nullptr;
+  }
+
+  // Record the position of every statement and every definition
+  // (and escape) of a variable
+  function->defs.resize(function->cfg->getNumBlockIDs());
+
+  for (const CFGBlock* block : *function->cfg) {
+    const uint id = block->getBlockID();
+    uint index = 0;
+
+    for (const CFGElement &element : *block) {
+      const auto cfgStmt = element.getAs<CFGStmt>();
+      if (!cfgStmt) {
+        index++;
+        continue;
+      }
+      const Stmt* stmt = cfgStmt->getStmt();
+      function->elements[stmt] = std::make_pair(id, index);
+
+      if (const auto declStmt = dyn_cast<DeclStmt>(stmt)) {
+        // A declaration without an initializer has an unknown value
+        for (const auto decl : declStmt->decls()) {
+          const auto var = dyn_cast<VarDecl>(decl);
+          if (var == nullptr) {
+            continue;
+          }
+          function->defs[id].push_back({var, index, var->getInit()});
+
+          // A reference that is bound to a variable can modify it
+          const auto init = var->getInit();
+          if (init != nullptr && var->getType()->isReferenceType()) {
+            if (const auto bound = getVar(init->IgnoreImplicit())) {
+              function->escaped.insert(bound);
+            }
+          }
+        }
+      }
+      else if (const auto binOp = dyn_cast<BinaryOperator>(stmt)) {
+        // Compound assignments, e.g. x += 1, have an unknown value
+        const auto var = binOp->isAssignmentOp() ?
+                         getVar(binOp->getLHS()) : nullptr;
+        if (var != nullptr) {
+          function->defs[id].push_back({var, index,
+            binOp->getOpcode() == BO_Assign ? binOp->getRHS() : nullptr});
+        }
+      }
+      else if (const auto unOp = dyn_cast<UnaryOperator>(stmt)) {
+        const auto var = getVar(unOp->getSubExpr());
+        if (var != nullptr && unOp->isIncrementDecrementOp()) {
+          function->defs[id].push_back({var, index, nullptr});
+        }
+        else if (var != nullptr && unOp->getOpcode() == UO_AddrOf) {
+          function->escaped.insert(var);
+        }
+      }
+      else if (const auto asmStmt = dyn_cast<AsmStmt>(stmt)) {
+        // The output operands of inline assembly are written to
+        for (const auto output : asmStmt->outputs()) {
+          if (const auto var = getVar(output)) {
+            function->escaped.insert(var);
+          }
+        }
+      }
+      index++;
+    }
+  }
+
+  PRINT_INFO("REF> CFG for " << caller->getName() << ": "
+             << function->cfg->size() << " blocks");
+
+  auto &entry = this->cfgs[caller];
+  entry = std::move(function);
+  return entry.get();
+}
+
+bool SecondPassMatcher::ReachingDefs::merge(const ReachingDefs &other) {
+  bool changed = other.unknown && !this->unknown;
+  this->unknown |= other.unknown;
+
+  for (const auto value : other.values) {
+    changed |= this->values.insert(value).second;
+  }
+  return changed;
 }
 
+/// Returns the definitions of the variable that reach the start of each
+/// block, these are computed once per variable and function
+const std::vector<SecondPassMatcher::ReachingDefs>&
+SecondPassMatcher::getBlockDefs(FunctionCFG &function, const VarDecl* var) {
+  auto &blockDefs = function.blockDefs[var];
+  if (!blockDefs.empty()) {
+    return blockDefs;
+  }
+
+  const CFG &cfg = *function.cfg;
+  blockDefs.resize(cfg.getNumBlockIDs());
+
+  // The last definition in each block is the only one that leaves it
+  std::vector<const Def*> lastDefs(cfg.getNumBlockIDs(), nullptr);
+  for (uint id = 0; id < cfg.getNumBlockIDs(); id++) {
+    for (const auto &def : function.defs[id]) {
+      if (def.var == var) {
+        lastDefs[id] = &def;
+      }
+    }
+  }
+
+  // The value on entry to the function is unknown, e.g. for parameters
+  blockDefs[cfg.getEntry().getBlockID()].unknown = true;
+
+  // The sets only ever grow, iterate until none of them change
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (const CFGBlock* block : cfg) {
+      auto &in = blockDefs[block->getBlockID()];
+
+      for (const auto &pred : block->preds()) {
+        const CFGBlock* predBlock = pred.getReachableBlock();
+        if (predBlock == nullptr) {
+          continue;
+        }
+
+        if (const Def* def = lastDefs[predBlock->getBlockID()]) {
+          ReachingDefs out;
+          out.unknown = def->value == nullptr;
+          if (def->value != nullptr) {
+            out.values.insert(def->value);
+          }
+          changed |= in.merge(out);
+        }
+        else if (predBlock != block) {
+          changed |= in.merge(blockDefs[predBlock->getBlockID()]);
+        }
+      }
+    }
+  }
+  return blockDefs;
+}
+
+/// Determine the definitions of the variable that reach the reference,
+/// returns false if the reference is not part of the CFG
+bool SecondPassMatcher::getReachingDefs(FunctionCFG &function,
+ const VarDecl* var, const DeclRefArg &arg, ReachingDefs &result) {
+  auto position = function.elements.find(arg.declRef);
+  if (position == function.elements.end()) {
+    position = function.elements.find(arg.call);
+  }
+  if (position == function.elements.end()) {
+    return false;
+  }
+  const uint id    = position->second.first;
+  const uint index = position->second.second;
+
+  // A definition earlier in the same block hides every other definition
+  const Def* last = nullptr;
+  for (const auto &def : function.defs[id]) {
+    if (def.var == var && def.index < index) {
+      last = &def;
+    }
+  }
+
+  if (last != nullptr) {
+    result.unknown = last->value == nullptr;
+    if (last->value != nullptr) {
+      result.values.insert(last->value);
+    }
+  } else {
+    result = this->getBlockDefs(function, var)[id];
+  }
+  return true;
+}
+
+/// Add the values of the reaching definitions as states of the argument,
+/// nothing is added (and false is returned) unless every definition
+/// assigns a literal
+bool SecondPassMatcher::addStates(ArgState &argState,
+ const ReachingDefs &defs) {
+  if (defs.unknown || defs.values.empty()) {
+    return false;
+  }
+
+  StateType type = NONE;
+  llvm::SmallVector<uint64_t, 4> intValues;
+  llvm::SmallVector<StringRef, 4> strValues;
+
+  for (const auto def : defs.values) {
+    // The same casts are ignored as for literal arguments in the first pass
+    const auto value = util::ignoreCasts(def, this->ctx);
+
+    if (const auto intLiteral = dyn_cast<IntegerLiteral>(value)) {
+      intValues.push_back(intLiteral->getValue().getLimitedValue());
+      type = INT;
+    }
+    else if (const auto chrLiteral = dyn_cast<CharacterLiteral>(value)) {
+      intValues.push_back(chrLiteral->getValue());
+      type = CHR;
+    }
+    else if (const auto strLiteral = dyn_cast<StringLiteral>(value)) {
+      if (strLiteral->getCharByteWidth() != 1) {
+        return false;
+      }
+      strValues.push_back(this->strings.save(strLiteral->getString()));
+      type = STR;
+    }
+    else if (const auto unaryExpr = dyn_cast<UnaryExprOrTypeTraitExpr>(value)) {
+      Expr::EvalResult res;
+      if (!unaryExpr->EvaluateAsInt(res, *this->ctx) ||
+          res.HasSideEffects || res.HasUndefinedBehavior) {
+        return false;
+      }
+      intValues.push_back(res.Val.getInt().getLimitedValue());
+      type = UNARY;
+    }
+    else {
+      return false;
+    }
+  }
+
+  // Only one of the state sets can be written for a parameter, e.g. a
+  // pointer that is assigned both 0 and a string cannot be det()
+  const bool isStr = !strValues.empty();
+  if ((isStr && (!intValues.empty() || argState.intStates.size() > 0)) ||
+      (!isStr && argState.strStates.size() > 0)) {
+    return false;
+  }
+
+  for (const auto value : intValues) {
+    argState.addState(value);
+  }
+  for (const auto value : strValues) {
+    argState.addState(value);
+  }
+  argState.type = type;
+  return true;
+}
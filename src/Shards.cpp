@@ -0,0 +1,50 @@
+#include "Shards.hpp"
+
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+
+#include <algorithm>
+
+using namespace clang;
+using namespace llvm;
+
+// Every thread takes several shards, a shard with a large function does not
+// hold up the other threads
+#define SHARDS_PER_THREAD 8
+
+std::vector<Decl*> filterDecls(ASTContext &ctx, ArrayRef<Decl*> decls,
+ unsigned threads, function_ref<bool(Decl*)> contains) {
+  if (ctx.getExternalSource() != nullptr || threads <= 1 ||
+      decls.size() <= 1) {
+    return std::vector<Decl*>(decls.begin(), decls.end());
+  }
+
+  // One flag per declaration, every shard writes to its own range
+  std::vector<char> keep(decls.size(), 0);
+  const size_t shardSize = std::max<size_t>(1,
+    (decls.size() + threads * SHARDS_PER_THREAD - 1) /
+    (threads * SHARDS_PER_THREAD));
+
+  {
+    ThreadPool pool(hardware_concurrency(threads));
+
+    for (size_t begin = 0; begin < decls.size(); begin += shardSize) {
+      const size_t end = std::min(begin + shardSize, decls.size());
+
+      pool.async([&, begin, end] {
+        for (size_t i = begin; i < end; i++) {
+          keep[i] = contains(decls[i]);
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  std::vector<Decl*> result;
+  for (size_t i = 0; i < decls.size(); i++) {
+    if (keep[i]) {
+      result.push_back(decls[i]);
+    }
+  }
+  return result;
+}
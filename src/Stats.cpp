@@ -0,0 +1,38 @@
+#include "Stats.hpp"
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdlib>
+#include <string>
+
+bool Stats::enabled() {
+  static const bool enabled = getenv(STATS_ENV) != NULL;
+  return enabled;
+}
+
+void Stats::print(llvm::StringRef tu) const {
+  if (!Stats::enabled()) {
+    return;
+  }
+
+  // The line is written at once, parallel compiler processes that share
+  // stderr do not interleave their summaries
+  std::string line;
+  llvm::raw_string_ostream os(line);
+
+  os << "stats> " << this->plugin << " " << tu << ":";
+  for (size_t i = 0; i < this->counters.size(); i++) {
+    os << " " << this->counterNames[i] << "=" << this->counters[i];
+  }
+  for (size_t i = 0; i < this->timers.size(); i++) {
+    const double ms = std::chrono::duration<double, std::milli>(
+      this->timers[i]).count();
+    os << " " << this->timerNames[i] << "=" << llvm::format("%.3f", ms)
+       << "ms";
+  }
+  os << "\n";
+  os.flush();
+
+  llvm::errs() << line;
+}
@@ -20,5 +20,13 @@ namespace util {
         }
   }
 
+  /// Strip every cast and paren around an expression, e.g.
+  ///  #define XML_FALSE ((XML_Bool)0)
+  /// is reduced to the IntegerLiteral
+  const Expr* ignoreCasts(const Expr* expr, ASTContext* ctx) {
+        return expr->IgnoreParenNoopCasts(*ctx)->IgnoreImplicit()
+                   ->IgnoreCasts();
+  }
+
 }
 
@@ -1,101 +1,217 @@
 #include "ArgStates.hpp"
 
-static void addComma(std::ofstream &f, uint iter, uint size, 
-  bool newline=false){
-    if (iter != size) {
-      f << ", ";
-    }
-    newline && f << "\n";
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+// The per-TU output files are written through a buffer of this size
+#define OUTPUT_BUFFER_SIZE (64*1024)
+
+/// String literals are not necessarily valid UTF-8 (e.g. "\xff"),
+/// invalid sequences are replaced rather than producing an invalid record
+static llvm::json::Value toJSONString(llvm::StringRef value) {
+  if (llvm::json::isUTF8(value)) {
+    return llvm::json::Value(value);
+  }
+  return llvm::json::Value(llvm::json::fixUTF8(value));
 }
-static void writeStates(const struct ArgState& argState, std::ofstream &f) {
-      uint stateSize = argState.states.size();
-      uint k = 0;
-      for (const auto &item : argState.states) {
-        // Write the correct type
-        switch(argState.type){
-          case INT:
-            f << std::get<uint64_t>(item);
-            break;
-          case CHR:
-            f << std::get<unsigned int>(item);
-            break;
-          case STR:
-            f << "\"" << std::get<std::string>(item) << "\"";
-            break;
-          case UNARY:
-            f << std::get<uint64_t>(item);
-            break;
-          default:
-            PRINT_ERR("ArgState with 'NONE' type encountered");
-        }
-        k++;
-        addComma(f,k,stateSize);
+
+/// nondet() arguments will be given an empty list of states
+/// det() arguments need to have an empty ids[] set, otherwise an invocation
+/// matched by ANY still exists that is nondet() for the argument
+static bool isNonDet(const ArgState &argState) {
+  return argState.isNonDet || argState.ids.size() != 0;
+}
+
+/// Fallback to parameter index for unnamed entries
+static std::string getParamName(const ArgState &argState, uint index) {
+  return argState.paramName.size()==0 ? std::to_string(index) :
+                                        argState.paramName.str();
+}
+
+static void writeStates(const ArgState &argState, llvm::json::OStream &j) {
+  // Write the store that corresponds to the type,
+  // only one of the state sets will contain values for an argument
+  switch(argState.type){
+    case INT:
+    case CHR:
+    case UNARY:
+      // json::Value has no unsigned 64-bit integers
+      for (const auto &item : argState.intStates) {
+        j.rawValue([&](llvm::raw_ostream &os){ os << item; });
+      }
+      break;
+    case STR:
+      for (const auto &item : argState.strStates) {
+        j.value(toJSONString(item));
       }
+      break;
+    default:
+      PRINT_ERR("ArgState with 'NONE' type encountered");
+  }
+}
+
+/// Write one record on the form
+///  {"symbol": "...", "tu": "...", "params": [
+///    {"name": "...", "nondet": false, "states": [...]}, ...
+///  ]}
+/// The states of nondet() params are always empty
+void writeRecord(llvm::raw_ostream &os, const std::string &symbolName,
+ llvm::StringRef tuPath, const std::vector<ArgState> &argumentStates) {
+  llvm::json::OStream j(os);
+
+  j.object([&]{
+    j.attribute("symbol", symbolName);
+    j.attribute("tu", toJSONString(tuPath));
+    j.attributeArray("params", [&]{
+      for (uint i = 0; i < argumentStates.size(); i++) {
+        const ArgState &argState = argumentStates[i];
+
+        j.object([&]{
+          j.attribute("name", getParamName(argState, i));
+          j.attribute("nondet", isNonDet(argState));
+          j.attributeArray("states", [&]{
+            if (!isNonDet(argState)) {
+              writeStates(argState, j);
+            }
+          });
+        });
+      }
+    });
+  });
+  os << "\n";
+}
+
+bool ArgStatesASTConsumer::appendArgStates(const char *logPath){
+  // All records of the TU are written with a single write() to a file
+  // opened with O_APPEND, i.e. records from concurrent processes never
+  // interleave. This does not hold for logs on NFS.
+  std::string records;
+  llvm::raw_string_ostream os(records);
+  uint recordCnt = 0;
+  const llvm::StringRef tuPath = this->tuPath.empty() ? this->filename :
+                                                        this->tuPath;
+
+  for (const auto &entry : this->argumentStates) {
+    if (entry.second.size() == 0) {
+      continue;
+    }
+    writeRecord(os, entry.first, tuPath, entry.second);
+    recordCnt++;
+  }
+  os.flush();
+
+  if (recordCnt == 0) {
+    return true;
+  }
+
+  PRINT_INFO("Appending " << recordCnt <<
+             " record(s) to: " << logPath);
+
+  const int fd = open(logPath, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0644);
+  if (fd < 0) {
+    PRINT_ERR("Failed to open " << logPath << ": " << strerror(errno));
+    return false;
+  }
+
+  // A short write would leave a truncated last line, which the compaction
+  // step skips. Retrying the remainder could split the records of the TU.
+  const ssize_t n = write(fd, records.data(), records.size());
+  const bool written = n == static_cast<ssize_t>(records.size());
+  if (!written) {
+    PRINT_ERR("Failed to write to " << logPath << ": " <<
+              (n < 0 ? strerror(errno) : "short write"));
+  }
+  close(fd);
+  return written;
+}
+
+bool ArgStatesASTConsumer::dumpArgStates(){
+  // One file is written for every symbol that is called in the current TU
+  bool written = true;
+  for (const auto &entry : this->argumentStates) {
+    written &= this->dumpArgStates(entry.first, entry.second);
+  }
+  return written;
 }
 
-void ArgStatesASTConsumer::dumpArgStates(){
+bool ArgStatesASTConsumer::dumpArgStates(const std::string &symbolName,
+ const std::vector<ArgState> &argumentStates){
   // We dump the argumentStates as JSON for the current TU only and join the
   // values externally in Python
-  if (this->argumentStates.size() == 0){
-    return;
+  if (argumentStates.size() == 0){
+    return true;
   }
-  auto filename = this->getOutputPath();
+  auto filename = this->getOutputPath(symbolName);
 
   if(filename.size()==0) { 
     PRINT_ERR("No output filename configured");
-    return; 
+    return false;
   } else {
     PRINT_INFO("Writing output to: " << filename);
   }
 
-  std::ofstream f;
-  f.open(filename, std::ofstream::out|std::ofstream::trunc);
-
-  f << "{\n"
-    << INDENT << "\"" << symbolName << "\": {\n";
-
-
-  std::string paramName;
-  ArgState argState;
-  uint argCnt = this->argumentStates.size();
-  for (uint i = 0; i < this->argumentStates.size(); i++) {
-    argState = this->argumentStates[i]; 
+  // The output is written to a temporary file in the same directory which
+  // is renamed into place once it is complete, a failed write never
+  // leaves a partial file behind
+  int fd;
+  llvm::SmallString<256> tmpPath;
+  if (auto ec = llvm::sys::fs::createUniqueFile(filename + ".%%%%%%.tmp",
+                                                fd, tmpPath)) {
+    PRINT_ERR("Failed to create " << filename << ": " << ec.message());
+    return false;
+  }
 
-    // Fallback to parameter index for unnamed entries
-    paramName = argState.paramName.size()==0 ? 
-                std::to_string(i) :
-                paramName = argState.paramName;
+  llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+  os.SetBufferSize(OUTPUT_BUFFER_SIZE);
+  {
+    llvm::json::OStream j(os, /*IndentSize=*/2);
 
-    f << INDENT << INDENT << "\"" << paramName << "\": [";
+    j.object([&]{
+      j.attributeObject(symbolName, [&]{
+        for (uint i = 0; i < argumentStates.size(); i++) {
+          const ArgState &argState = argumentStates[i];
 
-    // nondet() arguments will have been given an empty list of states
-    // det() arguments need to have an empty ids[] set, otherwise an invocation
-    // matched by ANY still exists that is nondet() for the argument
-    if (!argState.isNonDet && argState.ids.size() == 0){
-      f << "\n" << INDENT << INDENT << INDENT;
+          j.attributeArray(getParamName(argState, i), [&]{
+            if (!isNonDet(argState)) {
+              writeStates(argState, j);
+            }
+          });
+        }
+      });
+    });
+  }
+  os << "\n";
+  os.close();
 
-      // Only one of the state sets will contain values for an argument
-      writeStates(argState, f);
-      f << "\n" << INDENT << INDENT;
-    }
+  std::error_code ec = os.error();
+  os.clear_error();
 
-    f << "]";
-    
-    addComma(f,i+1,argCnt,true);
+  if (!ec) {
+    ec = llvm::sys::fs::rename(tmpPath, filename);
   }
-
-  f << INDENT << "}\n"
-    << "}\n";
-  f.close();
+  if (ec) {
+    PRINT_ERR("Failed to write " << filename << ": " << ec.message());
+    llvm::sys::fs::remove(tmpPath);
+    return false;
+  }
+  return true;
 }
 
-std::string ArgStatesASTConsumer::getOutputPath(){
-    const auto outputDir = std::string(getenv(OUTPUT_DIR_ENV));
-    if (this->filename.size() >= 2 && outputDir.size() > 0) {
+std::string ArgStatesASTConsumer::
+getOutputPath(const std::string &symbolName){
+    const char *outputDir = getenv(OUTPUT_DIR_ENV);
+    if (this->filename.size() >= 2 && outputDir != NULL &&
+        strlen(outputDir) > 0) {
       // <sym_name>_<tu>.json
       // Note that we include file extensions in the <tu> since
       // there could be .h and .c files with the same name
-      auto outputPath = outputDir + "/" + this->symbolName + "_" + 
+      auto outputPath = std::string(outputDir) + "/" + symbolName + "_" +
                         this->filename +
                         ".json";
       return outputPath;
@@ -103,4 +219,3 @@ std::string ArgStatesASTConsumer::getOutputPath(){
       return std::string();
     }
 }
-